@@ -27,9 +27,19 @@ function build_haproxy() {
 # Compile data_collector
 function build_collector() {
     mkdir build/data_collector
-    g++ -Isource \
+    g++ -Isource -Isource/haproxy-with/include -pthread \
         -o build/data_collector/data_collector \
-        source/data_collector/data_collector.cpp
+        source/data_collector/data_collector.cpp \
+        -x c source/haproxy-with/src/xxhash.c \
+        -lz
+}
+
+# Compile replayer
+function build_replayer() {
+    mkdir build/replayer
+    g++ -Isource -pthread \
+        -o build/replayer/replayer \
+        source/replayer/replayer.cpp
 }
 
 # Copy data_manager
@@ -44,8 +54,10 @@ function build_proxy() {
     mkdir build/http_proxy
     g++ -Isource \
         -std=c++11 \
+        -pthread \
         -o build/http_proxy/http_proxy \
-        source/http_proxy/http_proxy.cpp
+        source/http_proxy/http_proxy.cpp \
+        -lz
 }
 
 # Copy detector
@@ -118,6 +130,7 @@ case "$1" in
         build_classifier
         build_haproxy
         build_collector
+        build_replayer
         build_manager
         build_proxy
         build_detector
@@ -139,6 +152,9 @@ case "$1" in
     collector)
         build_collector
         ;;
+    replayer)
+        build_replayer
+        ;;
     manager)
         build_manager
         ;;
@@ -131,17 +131,22 @@ function run_application() {
 
 function run_backend() {
     cd build/http_proxy
-    PATH=$WORK_DIR/build/node/bin/:$PATH ./http_proxy
+    PATH=$WORK_DIR/build/node/bin/:$PATH ./http_proxy $@
 }
 
 function run_haproxy() {
     cd build/haproxy
-    ./haproxy -f my_proxy.cfg
+    ./haproxy -L ${1:-lb1} -f my_proxy.cfg
 }
 
 function run_collector() {
     cd build/data_collector
-    ./data_collector
+    ./data_collector $@
+}
+
+function run_replayer() {
+    cd build/replayer
+    ./replayer $@
 }
 
 function run_data_manager() {
@@ -162,6 +167,15 @@ function run_detector() {
     python detector.py
 }
 
+function run_detector_agent() {
+    if [ ! -d "output/model" ]; then
+        mkdir output/model
+    fi
+
+    cd build/detector
+    python spoe_agent.py
+}
+
 function run_attacker() {
     cd build/attacker
     python attacker_${1}.py ${@:2}
@@ -229,12 +243,18 @@ function main() {
         collector)
             run_collector ${@:2}
             ;;
+        replayer)
+            run_replayer ${@:2}
+            ;;
         data_manager)
             run_data_manager ${@:2}
             ;;
         detector)
             run_detector ${@:2}
             ;;
+        detector-agent)
+            run_detector_agent ${@:2}
+            ;;
         attacker)
             run_attacker ${@:2}
             ;;
@@ -6,12 +6,23 @@ import os
 import sys
 import math
 import time
+import mmap
+import struct
 
 all_letters = string.printable + '\0'
 n_letters = len(all_letters)
 all_categories = ['good', 'bad']
 n_categories = len(all_categories)
 
+# Sample log written by data_collector, see source/util/sample_log.h
+SAMPLE_LOG_MAGIC = b'RXIDX001'
+SAMPLE_LOG_RECORD = struct.Struct('<QIiqqB7x')
+
+LABEL_NONE = 0
+LABEL_BENIGN = 1
+LABEL_OUTLIER = 2
+LABEL_MALICIOUS = 3
+
 def letterToIndex(letter):
     return all_letters.find(letter)
 
@@ -61,6 +72,40 @@ class Dataset(object):
                 yield l[i: min(len(l), i + n)]
         return list(chunks(self.records, batch_size))
 
+class SampleLog(object):
+    # Maps the segments of a sample log folder. log[i] gives
+    # (id, label, latency, timestamp, data), where data is a memoryview
+    # into the mapped segment.
+    def __init__(self, folder):
+        self.logs = []
+        self.records = []
+        for filename in sorted(os.listdir(folder)):
+            if not filename.endswith('.idx'):
+                continue
+            with open(folder + '/' + filename, 'rb') as f:
+                index = f.read()
+            if index[:len(SAMPLE_LOG_MAGIC)] != SAMPLE_LOG_MAGIC:
+                continue
+            with open(folder + '/' + filename[:-4] + '.log', 'rb') as f:
+                size = os.fstat(f.fileno()).st_size
+                log = memoryview(mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) if size > 0 else b'')
+            self.logs.append(log)
+
+            count = (len(index) - len(SAMPLE_LOG_MAGIC)) // SAMPLE_LOG_RECORD.size
+            end = len(SAMPLE_LOG_MAGIC) + count * SAMPLE_LOG_RECORD.size
+            for offset, length, id, latency, timestamp, label in SAMPLE_LOG_RECORD.iter_unpack(index[len(SAMPLE_LOG_MAGIC):end]):
+                # Records whose bytes did not make it to the log yet
+                if offset + length > len(log):
+                    break
+                self.records.append((len(self.logs) - 1, offset, length, id, latency, timestamp, label))
+
+    def __len__(self):
+        return len(self.records)
+
+    def __getitem__(self, i):
+        segment, offset, length, id, latency, timestamp, label = self.records[i]
+        return id, label, latency, timestamp, self.logs[segment][offset:offset + length]
+
 class OfflineDataset(Dataset):
     def __init__(self, folder):
         super().__init__(
@@ -68,6 +113,17 @@ class OfflineDataset(Dataset):
             classes={}
         )
 
+        # A sample log from the collector, rather than one file per sample
+        if any(filename.endswith('.idx') for filename in os.listdir(folder)):
+            log = SampleLog(folder)
+            for i in range(len(log)):
+                id, label, latency, timestamp, data = log[i]
+                if label == LABEL_NONE:
+                    continue
+                category = 0 if label == LABEL_BENIGN else 1
+                self.insertItem(category, bytes(data).decode(errors='replace'))
+            return
+
         for filename in os.listdir(folder):
             category = int(filename.split('.')[0].split('-')[1])
             with open(folder + '/' + filename) as f:
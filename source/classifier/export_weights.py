@@ -0,0 +1,60 @@
+import os
+import struct
+import argparse
+
+import torch
+
+import model_cnn
+import data
+
+# Weights of model_cnn.Model for the regexnet-classify filter of HAProxy, see
+# source/haproxy-with/src/flt_regexnet_cnn.c. All little endian:
+#   magic, then vocab, embedding, channels, kernel, stride, levels, classes
+#   as u32, then the alphabet (vocab bytes, index i is the letter of
+#   embedding i), then as float32: embedding [vocab][embedding], conv weight
+#   [channels][embedding][kernel], conv bias [channels], linear weight
+#   [classes][channels * grids], linear bias [classes]
+WEIGHTS_MAGIC = b'RXCNN001'
+
+parser = argparse.ArgumentParser(description='Process some parameters.')
+parser.add_argument(
+    '--model_path',
+    required=True
+)
+parser.add_argument(
+    '--weights_path',
+    required=True
+)
+
+def export(model, weights_path):
+    model = model.to(torch.device('cpu'))
+    embedding = model.embeddings.weight.detach().float()
+    conv_weight = model.conv1.weight.detach().float()
+    conv_bias = model.conv1.bias.detach().float()
+    linear_weight = model.linear.weight.detach().float()
+    linear_bias = model.linear.bias.detach().float()
+
+    header = struct.pack('<7I',
+                         embedding.size(0), embedding.size(1),
+                         conv_weight.size(0), model.conv1.kernel_size[0], model.conv1.stride[0],
+                         model.spp_num_level, linear_weight.size(0))
+    alphabet = data.all_letters.encode('latin-1')
+
+    # The filter reloads the file when it changes: never let it see half of it
+    tmp_path = weights_path + '.tmp'
+    with open(tmp_path, 'wb') as f:
+        f.write(WEIGHTS_MAGIC)
+        f.write(header)
+        f.write(alphabet)
+        for tensor in (embedding, conv_weight, conv_bias, linear_weight, linear_bias):
+            f.write(struct.pack('<%df' % tensor.numel(), *tensor.contiguous().view(-1).tolist()))
+    os.rename(tmp_path, weights_path)
+
+def main():
+    args = parser.parse_args()
+    model = torch.load(args.model_path, map_location='cpu')
+    export(model, args.weights_path)
+    print ('Export weights to %s' % args.weights_path)
+
+if __name__ == "__main__":
+    main()
@@ -6,11 +6,28 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <linux/filter.h>
 
-#include <map>
+#include <poll.h>
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "util/udp_tool.h"
 #include "util/tcp_tool.h"
+#include "util/join_table.h"
+#include "util/sample_frame.h"
+#include "util/sample_dedup.h"
+#include "util/route_stats.h"
+#include "util/sample_log.h"
+#include "util/compress_tool.h"
+#include "util/metrics_tool.h"
 #include "util/tool.h"
 
 // load balancer addr, x5
@@ -18,12 +35,48 @@
 
 #define PORT_COLLECTOR  9003
 #define PORT_MANAGER    9004
+#define PORT_STATS      9006    // Metrics for scrapers, on the loopback only
 
 #define MAX_LENGTH 100000
 #define MALICIOUS_THRESHOLD 1
 
+#define BATCH_MAX_BYTES     (256 << 10) // A frame is closed once this large, or when the loop goes idle
+#define COMPRESS_FRAMES     CODEC_DEFLATE // Codecs offered to the manager, 0 for none
+#define HELLO_TIMEOUT_US    1000000     // Frames go out uncompressed if the manager does not answer the hello
+#define SEND_QUEUE_LIMIT    (64 << 20)  // Bytes waiting for the manager before samples are dropped
+#define RECONNECT_MIN_US    100000
+#define RECONNECT_MAX_US    5000000
+#define MAX_EVENTS          64
+
+#define JOIN_MAX_ENTRIES    65536
+#define JOIN_MAX_BYTES      (256 << 20) // Cap on buffered request bytes
+#define JOIN_TTL_US         10000000    // Requests whose response never comes are dropped after this
+#define JOIN_TICK_US        100000
+
+#define DEDUP_CAPACITY      (1 << 20)   // Recent request hashes remembered, see sample_dedup.h
+#define DEDUP_REPORT_US     10000000    // Period of duplicate counts sent to the manager
+
+#define STATS_WINDOW        1024        // Samples per route before its baseline decays exponentially
+#define STATS_WARMUP        32          // Samples of a route left unlabeled while its baseline forms
+#define STATS_MAX_ROUTES    1024
+#define OUTLIER_STDEVS      3
+#define MIN_LATENCY_STDEV   1000        // us
+#define MIN_LENGTH_STDEV    1
+#define BENIGN_RATE         10          // Benign samples per second forwarded for each route
+#define BENIGN_BURST        100
+
+#define SAMPLE_LOG_DIR      "/home/ubuntu/regexnet/build/sample_log"
+#define SAMPLE_LOG_SEGMENT  (256 << 20) // Bytes of requests per log segment
+
+#define NUM_SHARDS          1           // Default number of collector threads, see --threads
+#define MAX_SHARDS          64
+
+#define METRICS_PUBLISH_US  1000000     // Period of the snapshots served on PORT_STATS
+#define STATS_TIMEOUT_MS    1000        // Given to a scraper to send its request and read the answer
+
 #define MESSAGE_REQUEST     0
 #define MESSAGE_RESPONSE    1
+#define MESSAGE_COMPRESSED  0x100       // Flag on the type: the payload is deflate_datagram()'d
 
 using namespace std;
 
@@ -36,63 +89,716 @@ struct report_t {
 };
 
 class collector_listen_t: public udp_server_t {
+private:
+    report_t rpt;
+    report_t inflated;
+
 public:
-    collector_listen_t(int listen_addr, int listen_port): udp_server_t(listen_addr, listen_port) {}
+    long long num_datagrams;
+    long long num_bytes;
+    long long num_corrupt;
 
+    collector_listen_t(int listen_addr, int listen_port, bool reuse_port):
+        udp_server_t(listen_addr, listen_port, reuse_port), num_datagrams(0), num_bytes(0), num_corrupt(0) {}
+
+    // The report is only valid until the next call
     report_t* get_report() {
-        report_t *rpt = new report_t;
-        rpt->length = udp_recv((char*)(&(rpt->type)), MAX_LENGTH);
-        if (rpt->length < 1) {
-			delete rpt;
-			return NULL;
-		}
-        unsigned int offset = (char*)(&(rpt->buffer[0])) - (char*)(&(rpt->type));
-        rpt->length = rpt->length - offset;
-
-		return rpt;
+        unsigned int offset = (char*)(&(rpt.buffer[0])) - (char*)(&(rpt.type));
+        while (true) {
+            rpt.length = udp_recv((char*)(&(rpt.type)), offset + MAX_LENGTH);
+            if (rpt.length < 1)
+                return NULL;
+            ++num_datagrams;
+            num_bytes += rpt.length;
+            if (rpt.length < (int)offset)
+                continue;
+            rpt.length = rpt.length - offset;
+
+            if (!(rpt.type & MESSAGE_COMPRESSED))
+                break;
+            inflated.type = rpt.type & ~MESSAGE_COMPRESSED;
+            inflated.id = rpt.id;
+            inflated.timestamp = rpt.timestamp;
+            inflated.length = inflate_datagram(rpt.buffer, rpt.length, inflated.buffer, MAX_LENGTH);
+            if (inflated.length >= 0)
+                return &inflated;
+            ++num_corrupt;
+        }
+		return &rpt;
 	}
-} collector_listen(INADDR_ANY, PORT_COLLECTOR);
-
-map<int, report_t*> report_map;
-
-int main() {
-    //udp_client_t client(ip_str_to_int(ADDR_MANAGER), PORT_MANAGER);
-    tcp_client_t client;
-    while (true) {
-        report_t *rpt = collector_listen.get_report();
-        if (rpt != NULL) {
-            if (rpt->type == MESSAGE_REQUEST) {
-                report_t *req = rpt;
-                report_map.insert(pair<int, report_t*>(req->id, req));
+};
+
+int64_t get_time_us() {
+    return chrono::duration_cast<chrono::microseconds>(
+        chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+// One long-lived, non-blocking connection to the data manager. Samples wait in
+// a bounded queue while the manager is slow or away; once the queue is full new
+// samples are dropped. A lost connection is reopened with exponential backoff,
+// and a sample cut in the middle is sent again from its start. Frames are
+// compressed only as they go out, with the deflate stream of the connection,
+// after the manager agreed to it.
+class manager_link_t {
+private:
+    int epfd;
+    int remote_addr, remote_port;
+    int conn;
+    bool connected;
+    int64_t retry_time;
+    int64_t backoff;
+
+    frame_writer_t batch;
+    deque<vector<char> > queue;
+    deque<int64_t> queue_times; // When each frame was queued
+    size_t front_offset;
+    size_t queued_bytes;
+    size_t queue_limit;
+
+    int codec;
+    bool hello_queued;          // At the front of the queue
+    int64_t hello_deadline;     // Waiting for the answer until then, or 0
+    stream_deflater_t deflater;
+    vector<char> wire;          // Compressed form of the front frame
+    vector<char> reply;
+
+    void watch(int events) {
+        struct epoll_event event;
+        event.events = events;
+        event.data.fd = conn;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, conn, &event);
+    }
+
+    void open_connection(int64_t now) {
+        conn = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (conn < 0) {
+            perror("Socket creation failed");
+            retry_time = now + backoff;
+            return;
+        }
+
+        struct sockaddr_in serv_addr;
+        memset(&serv_addr, 0, sizeof(serv_addr));
+        serv_addr.sin_family = AF_INET;
+        serv_addr.sin_addr.s_addr = remote_addr;
+        serv_addr.sin_port = htons(remote_port);
+        if (connect(conn, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0 && errno != EINPROGRESS) {
+            close_connection(now);
+            return;
+        }
+
+        // Writable once the handshake completes
+        struct epoll_event event;
+        event.events = EPOLLOUT;
+        event.data.fd = conn;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, conn, &event);
+    }
+
+    void close_connection(int64_t now) {
+        if (conn >= 0) {
+            epoll_ctl(epfd, EPOLL_CTL_DEL, conn, NULL);
+            close(conn);
+        }
+        if (connected)
+            printf ("Lost connection to the manager, %zu bytes queued\n", queued_bytes);
+        if (hello_queued) {
+            queued_bytes -= queue.front().size();
+            queue.pop_front();
+            queue_times.pop_front();
+        }
+        conn = -1;
+        connected = false;
+        front_offset = 0;
+        codec = 0;
+        hello_queued = false;
+        hello_deadline = 0;
+        deflater.reset();
+        wire.clear();
+        reply.clear();
+        retry_time = now + backoff;
+        backoff = min<int64_t>(backoff * 2, RECONNECT_MAX_US);
+    }
+
+    void flush(int64_t now) {
+        while (!queue.empty()) {
+            if (hello_deadline != 0 && !hello_queued)
+                break;
+            vector<char> &frame = queue.front();
+            if (front_offset == 0 && wire.empty() && codec == CODEC_DEFLATE) {
+                wire.resize(FRAME_HEADER_SIZE);
+                if (deflater.compress(frame.data(), frame.size(), wire)) {
+                    uint32_t num_samples;
+                    memcpy(&num_samples, &frame[4], 4);
+                    put_frame_header(&wire[0], FRAME_FLAG_DEFLATE, ntohl(num_samples), wire.size() - FRAME_HEADER_SIZE);
+                }
+                else {
+                    // The stream is out of step now, start over on a new connection
+                    close_connection(now);
+                    return;
+                }
+            }
+            vector<char> &out = wire.empty() ? frame : wire;
+            ssize_t sent = send(conn, out.data() + front_offset, out.size() - front_offset, MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    watch(EPOLLIN | EPOLLOUT);
+                    return;
+                }
+                close_connection(now);
+                return;
+            }
+            front_offset += sent;
+            num_bytes_sent += sent;
+            if (front_offset == out.size()) {
+                queued_bytes -= frame.size();
+                num_bytes_raw += frame.size();
+                queue.pop_front();
+                send_lag.observe((get_time_us() - queue_times.front()) / 1e6);
+                queue_times.pop_front();
+                front_offset = 0;
+                wire.clear();
+                if (hello_queued) {
+                    hello_queued = false;
+                    hello_deadline = now + HELLO_TIMEOUT_US;
+                }
+            }
+        }
+        watch(EPOLLIN);
+    }
+
+public:
+    long long num_dropped;
+    long long num_bytes_raw;    // Frames sent, before compression
+    long long num_bytes_sent;
+    histogram_t send_lag;       // From queueing a frame to its last byte being sent
+
+    manager_link_t(int epfd_, int remote_addr_, int remote_port_, size_t queue_limit_):
+        epfd(epfd_), remote_addr(remote_addr_), remote_port(remote_port_), conn(-1), connected(false),
+        retry_time(0), backoff(RECONNECT_MIN_US), front_offset(0), queued_bytes(0), queue_limit(queue_limit_),
+        codec(0), hello_queued(false), hello_deadline(0), num_dropped(0), num_bytes_raw(0), num_bytes_sent(0) {}
+
+    int fd() {
+        return conn;
+    }
+
+    bool is_connected() {
+        return connected;
+    }
+
+    size_t queue_bytes() {
+        return queued_bytes + batch.bytes() - FRAME_HEADER_SIZE;
+    }
+
+    size_t queue_frames() {
+        return queue.size();
+    }
+
+    bool enqueue(const sample_t &sample, int64_t now) {
+        if (queued_bytes + batch.bytes() + SAMPLE_HEADER_SIZE + sample.length > queue_limit) {
+            ++num_dropped;
+            return false;
+        }
+        batch.append(sample);
+        if (batch.bytes() >= BATCH_MAX_BYTES)
+            seal(now);
+        return true;
+    }
+
+    // Queues a ready-made frame after the samples added so far
+    bool enqueue_frame(vector<char> &frame, int64_t now) {
+        seal(now);
+        if (queued_bytes + frame.size() > queue_limit) {
+            ++num_dropped;
+            return false;
+        }
+        queue.push_back(vector<char>());
+        queue.back().swap(frame);
+        queue_times.push_back(now);
+        queued_bytes += queue.back().size();
+        if (connected && queue.size() == 1)
+            flush(now);
+        return true;
+    }
+
+    // Closes the current batch into a frame and starts sending it
+    void seal(int64_t now) {
+        if (batch.size() == 0)
+            return;
+        queue.push_back(vector<char>());
+        batch.finish(queue.back());
+        queue_times.push_back(now);
+        queued_bytes += queue.back().size();
+        if (connected && queue.size() == 1)
+            flush(now);
+    }
+
+    void handle_event(int events, int64_t now) {
+        if (!connected) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(conn, SOL_SOCKET, SO_ERROR, &error, &length);
+            if (error != 0 || (events & (EPOLLERR | EPOLLHUP))) {
+                close_connection(now);
+                return;
+            }
+            printf ("Connected to the manager\n");
+            connected = true;
+            backoff = RECONNECT_MIN_US;
+            if (COMPRESS_FRAMES != 0) {
+                // Goes out first; nothing is half sent after a reconnect
+                queue.push_front(vector<char>());
+                make_hello_frame(queue.front(), COMPRESS_FRAMES);
+                queue_times.push_front(now);
+                queued_bytes += queue.front().size();
+                hello_queued = true;
+            }
+        }
+        else if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+            // The manager only ever answers the hello, otherwise readable means closed
+            char buffer[256];
+            ssize_t length = (events & (EPOLLERR | EPOLLHUP)) ? -1 : recv(conn, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (length <= 0) {
+                close_connection(now);
+                return;
+            }
+            reply.insert(reply.end(), buffer, buffer + length);
+            if (reply.size() >= FRAME_HEADER_SIZE + 4 && reply[3] == FRAME_FLAG_HELLO) {
+                uint32_t codecs;
+                memcpy(&codecs, &reply[FRAME_HEADER_SIZE], 4);
+                codec = ntohl(codecs) & COMPRESS_FRAMES;
+                hello_deadline = 0;
+                reply.erase(reply.begin(), reply.begin() + FRAME_HEADER_SIZE + 4);
+                printf ("Manager picked codec %d\n", codec);
+            }
+        }
+        flush(now);
+    }
+
+    // Milliseconds until the next reconnection attempt or hello timeout, or -1 if none is due
+    int timeout_ms(int64_t now) {
+        int64_t deadline = conn < 0 ? retry_time : hello_deadline;
+        if (deadline == 0)
+            return -1;
+        return deadline > now ? (int)((deadline - now + 999) / 1000) : 0;
+    }
+
+    void tick(int64_t now) {
+        if (conn < 0 && now >= retry_time)
+            open_connection(now);
+        if (hello_deadline != 0 && now >= hello_deadline) {
+            printf ("The manager did not answer the hello, sending uncompressed\n");
+            hello_deadline = 0;
+            flush(now);
+        }
+    }
+};
+
+// Splits request IDs among the shards by their lowest byte. The kernel runs
+// this BPF program for each datagram to pick a socket of the SO_REUSEPORT group,
+// so a request and its response always reach the same thread. Without it the
+// kernel hashes the source address, which still keeps a pair together as long
+// as the proxy sends both from one socket.
+bool attach_shard_filter(int sockfd, int num_shards) {
+    // The program sees the UDP payload: int type, then int id (little endian)
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 4),
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (unsigned int)num_shards),
+        BPF_STMT(BPF_RET | BPF_A, 0)
+    };
+    struct sock_fprog prog;
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+        perror("Attach reuseport filter failed");
+        return false;
+    }
+    return true;
+}
+
+enum {
+    METRIC_DATAGRAMS,
+    METRIC_DATAGRAM_BYTES,
+    METRIC_DATAGRAM_RATE,
+    METRIC_CORRUPT,
+    METRIC_JOINS,
+    METRIC_JOIN_RATE,
+    METRIC_ORPHANS,
+    METRIC_EXPIRED,
+    METRIC_EVICTED,
+    METRIC_REPLACED,
+    METRIC_JOIN_DROPPED,
+    METRIC_JOIN_ENTRIES,
+    METRIC_JOIN_BYTES,
+    METRIC_ROUTES,
+    METRIC_UNLABELED,
+    METRIC_BENIGN,
+    METRIC_OUTLIER,
+    METRIC_MALICIOUS,
+    METRIC_THINNED,
+    METRIC_DUPLICATES,
+    METRIC_QUEUE_BYTES,
+    METRIC_QUEUE_FRAMES,
+    METRIC_SEND_DROPPED,
+    METRIC_BYTES_OUT_RAW,
+    METRIC_BYTES_OUT,
+    METRIC_CONNECTED,
+    METRIC_LOG_SAMPLES,
+    METRIC_LOG_ERRORS,
+    NUM_METRICS
+};
+
+// Metrics sharing a name must be adjacent; each line also gets the shard label
+struct metric_desc_t {
+    const char *name;
+    const char *type;
+    const char *help;
+    const char *labels;
+};
+
+static const metric_desc_t METRICS[NUM_METRICS] = {
+    {"regexnet_collector_datagrams_total", "counter", "Datagrams received from the proxies.", ""},
+    {"regexnet_collector_datagram_bytes_total", "counter", "Bytes received from the proxies, as sent.", ""},
+    {"regexnet_collector_datagrams_per_second", "gauge", "Datagrams received per second over the last publish period.", ""},
+    {"regexnet_collector_corrupt_datagrams_total", "counter", "Compressed datagrams that failed to inflate.", ""},
+    {"regexnet_collector_joins_total", "counter", "Responses matched with their request.", ""},
+    {"regexnet_collector_joins_per_second", "gauge", "Joins per second over the last publish period.", ""},
+    {"regexnet_collector_orphan_responses_total", "counter", "Responses whose request was not in the join table.", ""},
+    {"regexnet_collector_orphan_requests_total", "counter", "Requests dropped from the join table.", "reason=\"expired\""},
+    {"regexnet_collector_orphan_requests_total", "counter", "Requests dropped from the join table.", "reason=\"evicted\""},
+    {"regexnet_collector_orphan_requests_total", "counter", "Requests dropped from the join table.", "reason=\"replaced\""},
+    {"regexnet_collector_orphan_requests_total", "counter", "Requests dropped from the join table.", "reason=\"too_large\""},
+    {"regexnet_collector_join_table_entries", "gauge", "Requests waiting for their response.", ""},
+    {"regexnet_collector_join_table_bytes", "gauge", "Bytes of requests waiting for their response.", ""},
+    {"regexnet_collector_routes", "gauge", "Routes with a latency baseline.", ""},
+    {"regexnet_collector_samples_total", "counter", "Joined samples by label.", "label=\"none\""},
+    {"regexnet_collector_samples_total", "counter", "Joined samples by label.", "label=\"benign\""},
+    {"regexnet_collector_samples_total", "counter", "Joined samples by label.", "label=\"outlier\""},
+    {"regexnet_collector_samples_total", "counter", "Joined samples by label.", "label=\"malicious\""},
+    {"regexnet_collector_thinned_samples_total", "counter", "Benign samples over the rate of their route.", ""},
+    {"regexnet_collector_duplicate_samples_total", "counter", "Samples sent as counts only.", ""},
+    {"regexnet_collector_send_queue_bytes", "gauge", "Bytes waiting to be sent to the manager.", ""},
+    {"regexnet_collector_send_queue_frames", "gauge", "Frames waiting to be sent to the manager.", ""},
+    {"regexnet_collector_send_dropped_total", "counter", "Samples dropped because the send queue was full.", ""},
+    {"regexnet_collector_frame_bytes_total", "counter", "Bytes of frames sent to the manager, before compression.", ""},
+    {"regexnet_collector_sent_bytes_total", "counter", "Bytes sent to the manager.", ""},
+    {"regexnet_collector_manager_connected", "gauge", "Whether the connection to the manager is up.", ""},
+    {"regexnet_collector_logged_samples_total", "counter", "Samples written to the sample log.", ""},
+    {"regexnet_collector_log_errors_total", "counter", "Samples lost to sample log errors.", ""},
+};
+
+#define SEND_LAG_METRIC     "regexnet_collector_send_lag_seconds"
+
+struct shard_metrics_t {
+    double values[NUM_METRICS];
+    histogram_t send_lag;
+};
+
+// One collector thread: its own UDP socket, its own slice of the join table
+// and its own connection to the manager.
+class collector_shard_t {
+private:
+    int index;
+    collector_listen_t collector_listen;
+    join_table_t join_table;
+    sample_dedup_t dedup;
+    route_table_t routes;
+    long long num_labeled[4];
+    long long num_thinned;
+    sample_log_writer_t sample_log;
+    int epfd;
+    manager_link_t manager;
+
+    // Read by the stats thread
+    mutex metrics_lock;
+    shard_metrics_t published;
+    int64_t published_time;
+
+    void handle_report(report_t *rpt, int64_t now) {
+        if (rpt->type == MESSAGE_REQUEST) {
+            join_table.insert(rpt->id, rpt->timestamp, rpt->buffer, rpt->length, now);
+            return;
+        }
+
+        report_t *res = rpt;
+        join_entry_t *req = join_table.find(res->id);
+        if (req == NULL) {
+            ++join_table.num_orphans;
+            return;
+        }
+        ++join_table.num_joined;
+        long long latency = res->timestamp - req->timestamp;
+
+        // Label against the route's baseline, then let the sample move it
+        route_stats_t &route = routes.lookup(req->data, req->length);
+        int label = LABEL_NONE;
+        if (route.latency.count >= STATS_WARMUP) {
+            if (!route.latency.outlier(latency, OUTLIER_STDEVS, MIN_LATENCY_STDEV))
+                label = LABEL_BENIGN;
+            else if (!route.length.outlier(req->length, OUTLIER_STDEVS, MIN_LENGTH_STDEV))
+                label = LABEL_OUTLIER;
+            else
+                label = LABEL_MALICIOUS;
+        }
+        route.latency.add_clamped(latency, OUTLIER_STDEVS, MIN_LATENCY_STDEV);
+        route.length.add_clamped(req->length, OUTLIER_STDEVS, MIN_LENGTH_STDEV);
+        ++num_labeled[label];
+
+        // Benign samples are plentiful, keep a few per route
+        if (label == LABEL_BENIGN && !route.take_token(now, BENIGN_RATE, BENIGN_BURST)) {
+            ++num_thinned;
+            join_table.remove(req);
+            return;
+        }
+
+        // Copies whose latencies are within a factor of two count as the same sample
+        uint64_t seed = 64 - __builtin_clzll(latency > 0 ? latency : 1);
+        if (!dedup.check(res->id, sample_dedup_t::hash(req->data, req->length, seed))) {
+            join_table.remove(req);
+            return;
+        }
+
+        sample_t sample;
+        sample.id = res->id;
+        sample.label = label;
+        sample.latency = latency;
+        sample.request_time = req->timestamp;
+        sample.response_time = res->timestamp;
+        sample.length = req->length;
+        sample.data = req->data;
+        sample_log.append(sample);
+        manager.enqueue(sample, now);
+
+        join_table.remove(req);
+    }
+
+    void publish(int64_t now) {
+        shard_metrics_t metrics;
+        double *v = metrics.values;
+        v[METRIC_DATAGRAMS] = collector_listen.num_datagrams;
+        v[METRIC_DATAGRAM_BYTES] = collector_listen.num_bytes;
+        v[METRIC_CORRUPT] = collector_listen.num_corrupt;
+        v[METRIC_JOINS] = join_table.num_joined;
+        v[METRIC_ORPHANS] = join_table.num_orphans;
+        v[METRIC_EXPIRED] = join_table.num_expired;
+        v[METRIC_EVICTED] = join_table.num_evicted;
+        v[METRIC_REPLACED] = join_table.num_replaced;
+        v[METRIC_JOIN_DROPPED] = join_table.num_dropped;
+        v[METRIC_JOIN_ENTRIES] = join_table.size();
+        v[METRIC_JOIN_BYTES] = join_table.bytes_used();
+        v[METRIC_ROUTES] = routes.size();
+        v[METRIC_UNLABELED] = num_labeled[LABEL_NONE];
+        v[METRIC_BENIGN] = num_labeled[LABEL_BENIGN];
+        v[METRIC_OUTLIER] = num_labeled[LABEL_OUTLIER];
+        v[METRIC_MALICIOUS] = num_labeled[LABEL_MALICIOUS];
+        v[METRIC_THINNED] = num_thinned;
+        v[METRIC_DUPLICATES] = dedup.num_duplicates;
+        v[METRIC_QUEUE_BYTES] = manager.queue_bytes();
+        v[METRIC_QUEUE_FRAMES] = manager.queue_frames();
+        v[METRIC_SEND_DROPPED] = manager.num_dropped;
+        v[METRIC_BYTES_OUT_RAW] = manager.num_bytes_raw;
+        v[METRIC_BYTES_OUT] = manager.num_bytes_sent;
+        v[METRIC_CONNECTED] = manager.is_connected();
+        v[METRIC_LOG_SAMPLES] = sample_log.num_samples;
+        v[METRIC_LOG_ERRORS] = sample_log.num_errors;
+        metrics.send_lag = manager.send_lag;
+
+        lock_guard<mutex> guard(metrics_lock);
+        double seconds = (now - published_time) / 1e6;
+        v[METRIC_DATAGRAM_RATE] = (v[METRIC_DATAGRAMS] - published.values[METRIC_DATAGRAMS]) / seconds;
+        v[METRIC_JOIN_RATE] = (v[METRIC_JOINS] - published.values[METRIC_JOINS]) / seconds;
+        published = metrics;
+        published_time = now;
+    }
+
+    void send_counts(int64_t now) {
+        frame_writer_t writer;
+        dedup.take_counts([&](int id, unsigned count) {
+            writer.append_count(id, count);
+        });
+        if (writer.size() == 0)
+            return;
+        vector<char> frame;
+        writer.finish(frame, FRAME_FLAG_COUNTS);
+        manager.enqueue_frame(frame, now);
+    }
+
+public:
+    collector_shard_t(int index_, int num_shards):
+        index(index_),
+        collector_listen(INADDR_ANY, PORT_COLLECTOR, num_shards > 1),
+        join_table(JOIN_MAX_ENTRIES / num_shards, JOIN_MAX_BYTES / num_shards, JOIN_TTL_US, JOIN_TICK_US),
+        dedup(DEDUP_CAPACITY / num_shards),
+        routes(STATS_MAX_ROUTES, STATS_WINDOW, BENIGN_BURST),
+        num_labeled(),
+        num_thinned(0),
+        sample_log(SAMPLE_LOG_DIR, ("shard" + to_string(index_)).c_str(), SAMPLE_LOG_SEGMENT),
+        epfd(epoll_create1(0)),
+        manager(epfd, ip_str_to_int(ADDR_MANAGER), PORT_MANAGER, SEND_QUEUE_LIMIT / num_shards),
+        published(),
+        published_time(get_time_us()) {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = collector_listen.sockfd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, collector_listen.sockfd, &event);
+    }
+
+    int sockfd() {
+        return collector_listen.sockfd;
+    }
+
+    void snapshot(shard_metrics_t &metrics) {
+        lock_guard<mutex> guard(metrics_lock);
+        metrics = published;
+    }
+
+    void run() {
+        struct epoll_event events[MAX_EVENTS];
+        int64_t publish_time = get_time_us() + METRICS_PUBLISH_US;
+        int64_t counts_time = get_time_us() + DEDUP_REPORT_US;
+        while (true) {
+            int64_t now = get_time_us();
+            manager.tick(now);
+            join_table.advance(now);
+            if (now >= publish_time) {
+                publish(now);
+                publish_time = now + METRICS_PUBLISH_US;
             }
-            else {
-                report_t *res = rpt;
-                auto itr = report_map.find(res->id);
-                if (itr == report_map.end())
-                    continue;
-                report_t *req = itr->second;
-                report_map.erase(itr);
-                long long latency = res->timestamp - req->timestamp;
-
-                int conn = -1;
-                while (conn < 0)
-                    conn = client.request_connection(ip_str_to_int(ADDR_MANAGER), PORT_MANAGER);
-
-                char metadata[128];
-                memset(metadata, 0, 128);
-                sprintf(metadata, "%32d; %64lld;", rpt->id, latency);
-                client.tcp_send(conn, metadata, 128);
-
-                client.tcp_send(conn, req->buffer, req->length);
-                printf ("Report: %s\n", metadata);
-                printf ("\tSent: %d\n", req->length);
-
-                shutdown(conn, SHUT_WR);
-                close(conn);
-
-                delete req;
-                delete res;
+            if (now >= counts_time) {
+                send_counts(now);
+                counts_time = now + DEDUP_REPORT_US;
             }
+
+            // Wake up at least once per tick to expire stale requests
+            int timeout = manager.timeout_ms(now);
+            if (timeout < 0 || timeout > JOIN_TICK_US / 1000)
+                timeout = JOIN_TICK_US / 1000;
+            int n = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+            now = get_time_us();
+            for (int i = 0; i < n; ++i) {
+                if (events[i].data.fd == collector_listen.sockfd) {
+                    report_t *rpt;
+                    while ((rpt = collector_listen.get_report()) != NULL)
+                        handle_report(rpt, now);
+                }
+                else if (events[i].data.fd == manager.fd()) {
+                    manager.handle_event(events[i].events, now);
+                }
+            }
+            // Samples joined in one wakeup go out together
+            manager.seal(now);
+            sample_log.flush();
+        }
+    }
+};
+
+// Serves the latest snapshot of every shard in the Prometheus text format,
+// one scrape at a time, on its own thread so the shards never wait on it
+class stats_server_t: public tcp_server_t {
+private:
+    vector<collector_shard_t*> shards;
+
+    string render() {
+        vector<shard_metrics_t> metrics(shards.size());
+        for (size_t i = 0; i < shards.size(); ++i)
+            shards[i]->snapshot(metrics[i]);
+
+        string out;
+        for (int m = 0; m < NUM_METRICS; ++m) {
+            if (m == 0 || strcmp(METRICS[m].name, METRICS[m - 1].name) != 0)
+                metric_family(out, METRICS[m].name, METRICS[m].type, METRICS[m].help);
+            for (size_t i = 0; i < shards.size(); ++i) {
+                string labels = "shard=\"" + to_string(i) + "\"";
+                if (METRICS[m].labels[0] != '\0')
+                    labels += string(",") + METRICS[m].labels;
+                metric_value(out, METRICS[m].name, labels, metrics[i].values[m]);
+            }
+        }
+        metric_family(out, SEND_LAG_METRIC, "histogram", "Time from queueing a frame for the manager to sending it.");
+        for (size_t i = 0; i < shards.size(); ++i)
+            metric_histogram(out, SEND_LAG_METRIC, "shard=\"" + to_string(i) + "\"", metrics[i].send_lag);
+        return out;
+    }
+
+    bool wait(int conn, short events) {
+        struct pollfd pfd;
+        pfd.fd = conn;
+        pfd.events = events;
+        return poll(&pfd, 1, STATS_TIMEOUT_MS) == 1;
+    }
+
+    void serve(int conn) {
+        // Any request gets the metrics; read it so that closing does not reset the connection
+        string request;
+        char buffer[1024];
+        while (request.find("\r\n\r\n") == string::npos && request.size() < 8192) {
+            if (!wait(conn, POLLIN))
+                break;
+            int length = tcp_recv(conn, buffer, sizeof(buffer));
+            if (length <= 0)
+                break;
+            request.append(buffer, length);
+        }
+
+        string body = render();
+        string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+            + to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        size_t offset = 0;
+        while (offset < response.size()) {
+            ssize_t sent = send(conn, response.data() + offset, response.size() - offset, MSG_NOSIGNAL);
+            if (sent > 0)
+                offset += sent;
+            else if (sent < 0 && errno == EAGAIN && wait(conn, POLLOUT))
+                continue;
+            else
+                break;
+        }
+        close(conn);
+    }
+
+public:
+    stats_server_t(const vector<collector_shard_t*> &shards_):
+        tcp_server_t(ip_str_to_int("127.0.0.1"), PORT_STATS), shards(shards_) {}
+
+    void run() {
+        while (true) {
+            if (!wait(sockfd, POLLIN))
+                continue;
+            int conn = accept_connection();
+            if (conn >= 0)
+                serve(conn);
         }
     }
+};
+
+int main(int argc, char **argv) {
+    int num_shards = NUM_SHARDS;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            num_shards = atoi(argv[++i]);
+        else {
+            printf ("Usage: %s [--threads N]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (num_shards < 1 || num_shards > MAX_SHARDS) {
+        printf ("The number of threads should be within [1, %d]\n", MAX_SHARDS);
+        return 1;
+    }
+
+    // Sockets join the SO_REUSEPORT group in order, so shard i owns socket i
+    vector<collector_shard_t*> shards;
+    for (int i = 0; i < num_shards; ++i)
+        shards.push_back(new collector_shard_t(i, num_shards));
+    if (num_shards > 1 && !attach_shard_filter(shards[0]->sockfd(), num_shards))
+        printf ("Datagrams are spread by source address instead of request ID\n");
+
+    stats_server_t *stats_server = new stats_server_t(shards);
+    printf ("Metrics on 127.0.0.1:%d\n", PORT_STATS);
+
+    vector<thread> threads;
+    threads.push_back(thread(&stats_server_t::run, stats_server));
+    for (int i = 1; i < num_shards; ++i)
+        threads.push_back(thread(&collector_shard_t::run, shards[i]));
+    shards[0]->run();
 }
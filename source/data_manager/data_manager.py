@@ -10,7 +10,10 @@ import string
 import time
 import os
 import math
+import struct
 import sys
+import zlib
+import collections
 
 PORT_DETECTOR = 9001
 PORT_WARNING = 9002
@@ -23,6 +26,7 @@ PORT_QUERY = 9005
 batch_size = 4
 model_path = '/home/ubuntu/regexnet/build/model.bin'
 flag_path  = '/home/ubuntu/regexnet/build/flag.txt'
+weights_path = '/home/ubuntu/regexnet/build/model.weights'
 train_data_folder = '/home/ubuntu/regexnet/build/train_data/'
 
 import torch
@@ -34,6 +38,7 @@ import model_cnn
 import data as data_module
 import train as train_module
 import test as test_module
+import export_weights
 
 gpu = torch.device("cuda:0" if torch.cuda.is_available() else "cpu")
 cpu = torch.device("cpu")
@@ -103,74 +108,176 @@ def is_strange(count, sum, sq_sum, value):
     else:
         return False
 
-def handle_report():
+# Frames from the collector, see source/util/sample_frame.h
+FRAME_MAGIC = 0x5258
+FRAME_VERSION = 1
+FRAME_HEADER = struct.Struct('!HBBII')
+SAMPLE_HEADER = struct.Struct('!iIB3xqqq')
+COUNT_RECORD = struct.Struct('!iI')
+FRAME_FLAG_COUNTS = 0x01
+FRAME_FLAG_DEFLATE = 0x02
+FRAME_FLAG_HELLO = 0x04
+CODEC_DEFLATE = 0x01
+CODECS = CODEC_DEFLATE      # Codecs accepted from the collector, 0 for none
+
+LABEL_NONE = 0
+LABEL_BENIGN = 1
+LABEL_OUTLIER = 2
+LABEL_MALICIOUS = 3
+
+report_total = 0
+report_length_sum = 0
+report_length_sq_sum = 0
+report_latency_sum = 0
+report_latency_sq_sum = 0
+report_cnt = 0
+
+def recv_exact(conn, length):
+    data = b''
+    while len(data) < length:
+        chunk = conn.recv(min(length - len(data), MAX_LENGTH))
+        if not chunk:
+            return None
+        data = data + chunk
+    return data
+
+def label_sample(latency, length):
+    # Only for samples the collector left unlabeled, while its baseline for
+    # the route is still forming. The baseline keeps moving until 900
+    # benign samples are in, as before the collector labelled them.
+    global report_total, report_length_sum, report_length_sq_sum
+    global report_latency_sum, report_latency_sq_sum
+
+    if len(data_benign) < 900:
+        report_total = report_total + 1
+        report_length_sum = report_length_sum + length
+        report_length_sq_sum = report_length_sq_sum + length * length
+        report_latency_sum = report_latency_sum + latency
+        report_latency_sq_sum = report_latency_sq_sum + latency * latency
+    elif report_total == 0:
+        return LABEL_BENIGN
+
+    if not is_strange(report_total, report_latency_sum, report_latency_sq_sum, latency):
+        return LABEL_BENIGN
+    if not is_strange(report_total, report_length_sum, report_length_sq_sum, length):
+        return LABEL_OUTLIER
+    return LABEL_MALICIOUS
+
+def handle_sample(id, label, latency, data):
     global lock
     global data_benign
     global data_malicious
+    global report_cnt
 
-    if not os.path.exists(train_data_folder):
-        os.mkdir(train_data_folder)
-
-    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
-    sock.bind(('0.0.0.0', PORT_REPORT))
-    sock.listen(16)
+    # The payload is raw request bytes, which need not be valid UTF-8
+    text = data.decode(errors='replace')
 
-    total = 0
-
-    length_sum = 0
-    length_sq_sum = 0
-
-    latency_sum = 0
-    latency_sq_sum = 0
-
-    cnt = 0
-
-    while True:
-        conn, _ = sock.accept()
+    with lock:
+        report_cnt = report_cnt + 1
+        if label == LABEL_NONE:
+            label = label_sample(latency, len(data))
 
-        metadata = conn.recv(128)
-        metadata = metadata.decode('UTF-8')
-        id = int(metadata.split(';')[0])
-        latency = int(metadata.split(';')[1])
-
-        data = b''
-        while len(data) < 1 or data[-1] != 0xa:
-            data = data + conn.recv(MAX_LENGTH)
-        conn.close()
-
-        if len(data_benign) < 900:
-            total = total + 1
-            length_sum = length_sum + len(data)
-            length_sq_sum = length_sq_sum + len(data) * len(data)
-            latency_sum = latency_sum + latency
-            latency_sq_sum = latency_sq_sum + latency * latency
-
-        cnt = cnt + 1
-        if not is_strange(total, latency_sum, latency_sq_sum, latency):
+        if label == LABEL_BENIGN:
         # if len(data)< 10000:
-            lock.acquire()
-
-            file_name = train_data_folder + str(cnt) + "-0.txt"
+            file_name = train_data_folder + str(report_cnt) + "-0.txt"
             with open(file_name,"a+") as f:
-                f.write(str(data.decode()))
+                f.write(text)
 
-            data_benign.append(data.decode())
+            data_benign.append(text)
             # if len(data_benign) > 2000:
             #     data_benign = data_benign[-1000:]
-            lock.release()
         else:
-            lock.acquire()
             print(len(data))
 
-            file_name = train_data_folder + str(cnt) + "-1.txt"
+            file_name = train_data_folder + str(report_cnt) + "-1.txt"
             with open(file_name,"a+") as f:
-                f.write(str(data.decode()))
+                f.write(text)
 
 
-            if is_strange(total, length_sum, length_sq_sum, len(data)):
+            if label == LABEL_MALICIOUS:
                 print ('Receive malicious sample %d: %d, %d' % (id, len(data), latency))
-                data_malicious.append(data.decode())
-            lock.release()
+                data_malicious.append(text)
+
+def parse_frame(flags, num_samples, body, handle_counts):
+    if flags & FRAME_FLAG_COUNTS:
+        for id, count in COUNT_RECORD.iter_unpack(body):
+            handle_counts(id, count)
+        return
+
+    offset = 0
+    for i in range(num_samples):
+        id, size, label, latency, request_time, response_time = SAMPLE_HEADER.unpack_from(body, offset)
+        offset = offset + SAMPLE_HEADER.size
+        yield id, label, latency, request_time, response_time, body[offset:offset + size]
+        offset = offset + size
+
+def read_frames(conn, handle_counts):
+    # Yields (id, label, latency, request_time, response_time, data) for
+    # every sample until the collector closes the connection. Duplicate
+    # counts go to handle_counts(id, count).
+    inflater = zlib.decompressobj(wbits=-15)
+    while True:
+        header = recv_exact(conn, FRAME_HEADER.size)
+        if header is None:
+            return
+        magic, version, flags, num_samples, length = FRAME_HEADER.unpack(header)
+        if magic != FRAME_MAGIC or version != FRAME_VERSION:
+            print ('Unknown frame version %d from the collector' % version)
+            return
+        body = recv_exact(conn, length)
+        if body is None:
+            return
+
+        if flags & FRAME_FLAG_HELLO:
+            # Answer with the codec to use on this connection
+            codecs, = struct.unpack('!I', body[:4])
+            conn.sendall(FRAME_HEADER.pack(FRAME_MAGIC, FRAME_VERSION, FRAME_FLAG_HELLO, 0, 4) +
+                         struct.pack('!I', codecs & CODECS))
+            continue
+
+        if flags & FRAME_FLAG_DEFLATE:
+            # The body is a whole frame, sync-flushed on the connection's stream
+            frame = inflater.decompress(body)
+            magic, version, flags, num_samples, length = FRAME_HEADER.unpack_from(frame)
+            body = frame[FRAME_HEADER.size:]
+
+        yield from parse_frame(flags, num_samples, body, handle_counts)
+
+MAX_DUPLICATE_IDS = 10000
+duplicate_counts = collections.OrderedDict()
+duplicate_total = 0
+
+def handle_counts(id, count):
+    # The collector forwards one copy of identical requests and reports how
+    # many more it has seen, keyed by the ID of the copy it forwarded. Only
+    # the most recently reported IDs are kept.
+    global duplicate_total
+
+    with lock:
+        duplicate_counts[id] = duplicate_counts.pop(id, 0) + count
+        if len(duplicate_counts) > MAX_DUPLICATE_IDS:
+            duplicate_counts.popitem(last=False)
+        duplicate_total = duplicate_total + count
+
+def handle_collector(conn):
+    for id, label, latency, request_time, response_time, data in read_frames(conn, handle_counts):
+        handle_sample(id, label, latency, data)
+    conn.close()
+
+def handle_report():
+    if not os.path.exists(train_data_folder):
+        os.mkdir(train_data_folder)
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(('0.0.0.0', PORT_REPORT))
+    sock.listen(16)
+
+    while True:
+        conn, _ = sock.accept()
+        c = threading.Thread(target=handle_collector, args=(conn,))
+        c.daemon = True
+        c.start()
 
 def handle_training():
     global lock
@@ -194,6 +301,11 @@ def handle_training():
             last_benign_count = len(data_benign)
             print("data_benign:"+str(len(data_benign)))
             print("data_malicious:"+str(len(data_malicious)))
+            print("data_duplicate:"+str(duplicate_total))
+            with lock:
+                if duplicate_counts:
+                    id, count = max(duplicate_counts.items(), key=lambda item: item[1])
+                    print("most_duplicated: sample %d, %d copies" % (id, count))
 
             flag = False
             while test_batch(model, data_benign, data_malicious) < 0.99:
@@ -203,6 +315,7 @@ def handle_training():
             if flag:
                 model.to(cpu)
                 torch.save(model, model_path)
+                export_weights.export(model, weights_path)
                 os.system('echo finish > %s' % flag_path)
                 print ("Save model")
                 # transferring model is performed by management process
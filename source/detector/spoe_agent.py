@@ -0,0 +1,278 @@
+import socket
+import threading
+import queue
+import string
+import time
+import os
+import struct
+
+import torch
+
+import detector
+
+# The detector as a SPOE agent: HAProxy sends the request line and the header
+# block of every request in a NOTIFY frame and waits, at most "timeout
+# processing", for the verdict. Malicious requests get txn.<prefix>.bad set
+# to true; anything else (benign, no model yet, late answer) leaves it unset
+# and the request goes on as usual. See haproxy-with/config/regexnet-spoe.conf.
+
+PORT_AGENT = 9007
+MAX_FRAME_SIZE = 256000     # Never above the one HAProxy offers
+STALE_S = 0.02              # "timeout processing" in regexnet-spoe.conf: HAProxy no longer waits
+
+SPOP_VERSION = '2.0'
+CAPABILITIES = 'pipelining,async'
+
+FRAME_HAPROXY_HELLO = 1
+FRAME_HAPROXY_DISCONNECT = 2
+FRAME_NOTIFY = 3
+FRAME_AGENT_HELLO = 101
+FRAME_AGENT_DISCONNECT = 102
+FRAME_ACK = 103
+FLAG_FIN = 0x00000001
+
+DATA_NULL = 0
+DATA_BOOL = 1
+DATA_INT32 = 2
+DATA_UINT32 = 3
+DATA_INT64 = 4
+DATA_UINT64 = 5
+DATA_IPV4 = 6
+DATA_IPV6 = 7
+DATA_STRING = 8
+DATA_BINARY = 9
+DATA_TRUE = 0x10
+
+ACTION_SET_VAR = 1
+SCOPE_TRANSACTION = 2
+
+ERROR_NONE = 0
+ERROR_INVALID = 4
+ERROR_BAD_VERSION = 8
+ERROR_FRAGMENTATION = 10
+
+PRINTABLE = set(string.printable)
+
+task_q = queue.Queue()
+
+def encode_varint(i):
+    if i < 240:
+        return bytes([i])
+    out = bytearray([(i | 240) & 0xff])
+    i = (i - 240) >> 4
+    while i >= 128:
+        out.append((i | 128) & 0xff)
+        i = (i - 128) >> 7
+    out.append(i)
+    return bytes(out)
+
+def decode_varint(data, pos):
+    i = data[pos]
+    pos += 1
+    if i < 240:
+        return i, pos
+    shift = 4
+    while True:
+        b = data[pos]
+        pos += 1
+        i += b << shift
+        shift += 7
+        if b < 128:
+            return i, pos
+
+def encode_string(s):
+    b = s.encode('latin-1') if isinstance(s, str) else s
+    return encode_varint(len(b)) + b
+
+def decode_string(data, pos):
+    length, pos = decode_varint(data, pos)
+    return data[pos: pos + length], pos + length
+
+def encode_typed(value):
+    if isinstance(value, bool):
+        return bytes([DATA_BOOL | (DATA_TRUE if value else 0)])
+    if isinstance(value, int):
+        return bytes([DATA_UINT32]) + encode_varint(value)
+    return bytes([DATA_STRING]) + encode_string(value)
+
+def decode_typed(data, pos):
+    kind = data[pos]
+    pos += 1
+    type = kind & 0x0f
+    if type == DATA_NULL:
+        return None, pos
+    if type == DATA_BOOL:
+        return bool(kind & DATA_TRUE), pos
+    if type in (DATA_INT32, DATA_UINT32, DATA_INT64, DATA_UINT64):
+        return decode_varint(data, pos)
+    if type == DATA_IPV4:
+        return socket.inet_ntop(socket.AF_INET, data[pos: pos + 4]), pos + 4
+    if type == DATA_IPV6:
+        return socket.inet_ntop(socket.AF_INET6, data[pos: pos + 16]), pos + 16
+    if type in (DATA_STRING, DATA_BINARY):
+        return decode_string(data, pos)
+    raise ValueError('unknown data type %d' % type)
+
+def decode_kv_list(data, pos, end):
+    values = {}
+    while pos < end:
+        key, pos = decode_string(data, pos)
+        values[key.decode('latin-1')], pos = decode_typed(data, pos)
+    return values
+
+def make_frame(type, stream_id, frame_id, payload):
+    frame = bytes([type]) + struct.pack('!I', FLAG_FIN) + encode_varint(stream_id) + encode_varint(frame_id) + payload
+    return struct.pack('!I', len(frame)) + frame
+
+def make_kv_list(values):
+    return b''.join(encode_string(key) + encode_typed(value) for key, value in values)
+
+def make_ack(stream_id, frame_id, bad):
+    actions = b''
+    if bad:
+        actions = bytes([ACTION_SET_VAR, 3, SCOPE_TRANSACTION]) + encode_string('bad') + encode_typed(True)
+    return make_frame(FRAME_ACK, stream_id, frame_id, actions)
+
+def recv_exact(conn, length):
+    data = b''
+    while len(data) < length:
+        chunk = conn.recv(length - len(data))
+        if not chunk:
+            return None
+        data += chunk
+    return data
+
+class agent_conn_t(object):
+    def __init__(self, conn):
+        self.conn = conn
+        self.lock = threading.Lock()
+        self.max_frame_size = MAX_FRAME_SIZE
+
+    def send(self, frame):
+        with self.lock:
+            try:
+                self.conn.sendall(frame)
+            except OSError:
+                pass
+
+    def disconnect(self, status, message):
+        self.send(make_frame(FRAME_AGENT_DISCONNECT, 0, 0,
+                             make_kv_list([('status-code', status), ('message', message)])))
+
+    def recv_frame(self):
+        length_b = recv_exact(self.conn, 4)
+        if length_b is None:
+            return None
+        length = struct.unpack('!I', length_b)[0]
+        if length > self.max_frame_size:
+            return None
+        frame = recv_exact(self.conn, length)
+        if frame is None or len(frame) < 7:
+            return None
+        flags = struct.unpack('!I', frame[1: 5])[0]
+        stream_id, pos = decode_varint(frame, 5)
+        frame_id, pos = decode_varint(frame, pos)
+        return frame[0], flags, stream_id, frame_id, frame, pos
+
+    def hello(self, frame, pos):
+        values = decode_kv_list(frame, pos, len(frame))
+        versions = values.get('supported-versions', b'').decode().replace(' ', '').split(',')
+        if SPOP_VERSION not in versions:
+            self.disconnect(ERROR_BAD_VERSION, 'unsupported version')
+            return False
+        self.max_frame_size = min(MAX_FRAME_SIZE, values.get('max-frame-size', MAX_FRAME_SIZE))
+        self.send(make_frame(FRAME_AGENT_HELLO, 0, 0, make_kv_list([
+            ('version', SPOP_VERSION),
+            ('max-frame-size', self.max_frame_size),
+            ('capabilities', CAPABILITIES)])))
+        # A health check closes right after the hello
+        return not values.get('healthcheck', False)
+
+    # Rebuilds the text the model is trained on out of the message arguments
+    def notify(self, stream_id, frame_id, frame, pos):
+        args = {}
+        while pos < len(frame):
+            _, pos = decode_string(frame, pos)
+            num_args = frame[pos]
+            pos += 1
+            for _ in range(num_args):
+                key, pos = decode_string(frame, pos)
+                args[key.decode('latin-1')], pos = decode_typed(frame, pos)
+        line = b'%s %s HTTP/%s\r\n%s' % (args.get('method') or b'', args.get('url') or b'',
+                                        args.get('ver') or b'', args.get('hdrs') or b'')
+        line = ''.join(c if c in PRINTABLE else '\0' for c in line.decode('latin-1'))
+        task_q.put((time.time(), self, stream_id, frame_id, line))
+
+def handle_connection(conn):
+    agent_conn = agent_conn_t(conn)
+    try:
+        frame = agent_conn.recv_frame()
+        if frame is None or frame[0] != FRAME_HAPROXY_HELLO or not agent_conn.hello(frame[4], frame[5]):
+            return
+        while True:
+            frame = agent_conn.recv_frame()
+            if frame is None:
+                break
+            type, flags, stream_id, frame_id, data, pos = frame
+            if type == FRAME_HAPROXY_DISCONNECT:
+                agent_conn.disconnect(ERROR_NONE, 'bye')
+                break
+            if type != FRAME_NOTIFY:
+                agent_conn.disconnect(ERROR_INVALID, 'unexpected frame')
+                break
+            if not flags & FLAG_FIN:
+                agent_conn.disconnect(ERROR_FRAGMENTATION, 'fragmentation not supported')
+                break
+            agent_conn.notify(stream_id, frame_id, data, pos)
+    except (OSError, ValueError, IndexError) as e:
+        print ('SPOE connection error: %s' % e)
+    finally:
+        conn.close()
+
+def handle_request(model_path, flag_path):
+    model = None
+    flag_mdate = None
+    while True:
+        tasks = [task_q.get()]
+        while len(tasks) < detector.BATCH_SIZE and not task_q.empty():
+            tasks.append(task_q.get())
+
+        if os.path.isfile(flag_path) and flag_mdate != os.stat(flag_path)[8]:
+            model = torch.load(model_path)
+            flag_mdate = os.stat(flag_path)[8]
+            print ('Input model')
+
+        # Fail open: no model yet, or HAProxy no longer waits
+        now = time.time()
+        fresh = []
+        for task in tasks:
+            if model is None or now - task[0] > STALE_S:
+                task[1].send(make_ack(task[2], task[3], False))
+            else:
+                fresh.append(task)
+        if not fresh:
+            continue
+
+        guess, _, _ = detector.classify(model, [task[4] for task in fresh])
+        for i in range(len(fresh)):
+            fresh[i][1].send(make_ack(fresh[i][2], fresh[i][3], guess[i] == 1))
+
+def main():
+    # Warmup CUDA
+    torch.randn(1024, device='cuda').sum()
+
+    worker = threading.Thread(target=handle_request, args=(detector.model_path, detector.flag_path))
+    worker.daemon = True
+    worker.start()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(('0.0.0.0', PORT_AGENT))
+    sock.listen(64)
+    while True:
+        conn, addr = sock.accept()
+        conn.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        threading.Thread(target=handle_connection, args=(conn,), daemon=True).start()
+
+if __name__ == "__main__":
+    main()
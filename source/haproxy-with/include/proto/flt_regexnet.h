@@ -0,0 +1,21 @@
+/*
+ * include/proto/flt_regexnet.h
+ * This file defines function prototypes for the RegexNet mirroring filter.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ *
+ */
+#ifndef _PROTO_FLT_REGEXNET_H
+#define _PROTO_FLT_REGEXNET_H
+
+#include <types/proxy.h>
+#include <types/stats.h>
+
+void regexnet_fill_info(struct field *info);
+void regexnet_fill_stats(struct proxy *px, struct field *stats);
+
+
+#endif // _PROTO_FLT_REGEXNET_H
@@ -291,6 +291,12 @@ enum info_field {
 	INF_STOPPING,
 	INF_JOBS,
 	INF_LISTENERS,
+	INF_REGEXNET_MIRRORED,
+	INF_REGEXNET_MIRROR_RATE,
+	INF_REGEXNET_MIRROR_BPS,
+	INF_REGEXNET_DROPPED,
+	INF_REGEXNET_DROP_RATE,
+	INF_REGEXNET_QUEUED,
 
 	/* must always be the last one */
 	INF_TOTAL_FIELDS
@@ -386,6 +392,11 @@ enum stat_field {
 	ST_F_INTERCEPTED,
 	ST_F_DCON,
 	ST_F_DSES,
+	ST_F_MIRROR_REQ,
+	ST_F_MIRROR_RATE,
+	ST_F_MIRROR_BYTES,
+	ST_F_MIRROR_DROP,
+	ST_F_MIRROR_QCUR,
 
 	/* must always be the last one */
 	ST_F_TOTAL_FIELDS
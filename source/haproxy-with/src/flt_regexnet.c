@@ -0,0 +1,1559 @@
+/*
+ * RegexNet mirroring filter: copies HTTP requests to the detector.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ *
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <common/buffer.h>
+#include <common/cfgparse.h>
+#include <common/chunk.h>
+#include <common/hash.h>
+#include <common/standard.h>
+#include <common/time.h>
+#include <common/hathreads.h>
+
+#include <types/arg.h>
+#include <types/channel.h>
+#include <types/cli.h>
+#include <types/filters.h>
+#include <types/global.h>
+#include <types/proto_http.h>
+#include <types/proxy.h>
+#include <types/stats.h>
+#include <types/stream.h>
+
+#include <proto/acl.h>
+#include <proto/arg.h>
+#include <proto/channel.h>
+#include <proto/cli.h>
+#include <proto/connection.h>
+#include <proto/filters.h>
+#include <proto/flt_regexnet.h>
+#include <proto/freq_ctr.h>
+#include <proto/hdr_idx.h>
+#include <proto/log.h>
+#include <proto/proto_http.h>
+#include <proto/proxy.h>
+#include <proto/sample.h>
+#include <proto/server.h>
+#include <proto/stats.h>
+#include <proto/stream.h>
+#include <proto/stream_interface.h>
+
+/* Requests are mirrored without ever blocking the event loop: the filter
+ * copies the request into a message and pushes it on a bounded lock-free ring
+ * of the detector, and a dedicated sender thread per detector drains it into
+ * the detector connection. With nbthread > 1, each thread has its own ring
+ * per detector and its own counters, so that threads never contend on a
+ * shared queue or cache line; the sender drains the rings in turn and the
+ * counters are only summed when read. When a ring or its byte budget is
+ * full, the request is dropped for that detector and counted. The counters
+ * and their rates are reported by "show info", "show stat" and "show
+ * regexnet" on the stats socket.
+ *
+ * The detectors form a pool. By default each request goes to one of them,
+ * picked by consistent hashing on the client address or the unique id, so
+ * that adding or losing a detector only moves its share of the clients. A
+ * detector whose sender cannot connect is marked down and its share fails
+ * over to the next detectors on the ring until a reconnection succeeds, with
+ * an exponential backoff between attempts. "balance all" sends every request
+ * to every detector instead.
+ *
+ * An "if" or "unless" condition restricts mirroring to the requests worth
+ * a look, typically on the req.hdr_* fetches below which describe the shape
+ * of the header block: the longest header line, the longest run of a
+ * character, the share of a character class. The sender writes each
+ * message fully or drops the connection, so a short write never leaves the
+ * detector out of frame. On the wire, each request is preceded by its length
+ * as a 32-bit big endian integer.
+ *
+ * The header block is always mirrored whole, as the detector reads X-Unique-ID
+ * and X-Server out of it. When the backend sends the server name in a header,
+ * the message waits in the stream until the server connection is established
+ * and the filter adds that header itself.
+ */
+#define REGEXNET_MAX_BYTES	2048		/* default bytes of body mirrored after the headers */
+#define REGEXNET_QUEUE_SIZE	4096		/* default messages queued per detector */
+#define REGEXNET_QUEUE_MAX	(1 << 20)
+#define REGEXNET_QUEUE_BYTES	(64 << 20)	/* bytes of queued messages per detector */
+#define REGEXNET_RETRY_MIN_US	100000
+#define REGEXNET_RETRY_MAX_US	5000000
+#define REGEXNET_IDLE_MS	10		/* senders wake up at least this often */
+#define REGEXNET_CHASH_POINTS	64		/* points per detector on the hash ring */
+#define REGEXNET_CACHELINE	64
+
+/* How requests are spread over the detectors */
+enum regexnet_balance {
+	REGEXNET_BALANCE_SRC = 0,		/* hash of the client address */
+	REGEXNET_BALANCE_UNIQUE_ID,		/* hash of the unique id, else as SRC */
+	REGEXNET_BALANCE_ALL,			/* every detector gets every request */
+};
+
+const char *regexnet_flt_id = "regexnet-mirror filter";
+
+struct flt_ops regexnet_ops;
+
+struct regexnet_msg {
+	unsigned int refs;			/* one per detector it is queued to */
+	unsigned int size;			/* of data, including the length prefix */
+	char data[0];				/* u32 length (big endian), then the request */
+};
+
+struct regexnet_slot {
+	unsigned int seq;
+	struct regexnet_msg *msg;
+};
+
+/* The counters of a filter written by one thread */
+struct regexnet_counters {
+	unsigned long long       mirrored;	/* requests */
+	unsigned long long       bytes;		/* queued to the detectors */
+	unsigned long long       dropped;	/* messages not queued */
+	struct freq_ctr          mirror_rate;
+	struct freq_ctr          bytes_rate;
+	struct freq_ctr          drop_rate;
+} __attribute__((aligned(REGEXNET_CACHELINE)));
+
+/* The same, summed over the threads and the filters */
+struct regexnet_totals {
+	unsigned long long       mirrored;
+	unsigned long long       bytes;
+	unsigned long long       dropped;
+	unsigned int             mirror_rate;
+	unsigned int             bytes_rate;
+	unsigned int             drop_rate;
+	unsigned long long       queued;	/* messages waiting for the senders */
+};
+
+/* The messages of one thread to one detector */
+struct regexnet_ring {
+	struct regexnet_slot    *slots;
+	unsigned int             size;		/* a power of two */
+	unsigned int             head;		/* next slot to fill, its thread only */
+	unsigned int             tail;		/* next slot to drain, sender only */
+	unsigned long            queued_bytes;	/* added by its thread, removed by the sender */
+
+	/* written by its thread only, summed when read */
+	unsigned long long       num_queued;
+	unsigned long long       num_dropped;
+} __attribute__((aligned(REGEXNET_CACHELINE)));
+
+struct regexnet_detector {
+	char                    *id;		/* address as configured */
+	struct sockaddr_storage  addr;
+	struct regexnet_ring    *rings;		/* one per thread */
+	int                      num_rings;
+	int                      next_ring;	/* drained next, sender only */
+	int                      fd;
+	int                      up;		/* last connection attempt succeeded */
+	int                      idle;		/* the sender waits for messages */
+	int                      stopping;
+	int                      started;
+	pthread_t                thread;
+	pthread_mutex_t          lock;
+	pthread_cond_t           cond;
+
+	/* written by the sender only, readable at any time */
+	unsigned long long       num_sent;
+	unsigned long long       num_dropped;	/* lost with the connection */
+
+	struct regexnet_detector *next;
+};
+
+/* A point of the consistent hash ring */
+struct regexnet_point {
+	unsigned int              hash;
+	struct regexnet_detector *det;
+};
+
+struct regexnet_header {
+	char                   *name;
+	int                     len;
+	struct regexnet_header *next;
+};
+
+struct regexnet_config {
+	struct proxy             *proxy;
+	char                     *name;
+	struct regexnet_detector *detectors;
+	int                       num_detectors;
+	enum regexnet_balance     balance;
+	struct regexnet_point    *points;		/* sorted by hash */
+	int                       num_points;
+	double                    sample;		/* ratio of requests mirrored */
+	unsigned int              sample_below;		/* mirrored when rand_r() is below */
+	unsigned int              max_bytes;		/* of body, after the header block */
+	unsigned int              queue_size;
+	struct regexnet_header   *headers;		/* allow-list, all headers if empty */
+	struct acl_cond          *cond;			/* mirror only if it matches */
+	struct regexnet_counters *counters;		/* one per thread */
+};
+
+/* Character classes of req.hdr_charclass_ratio */
+enum regexnet_class {
+	REGEXNET_CLASS_ALPHA = 0,
+	REGEXNET_CLASS_DIGIT,
+	REGEXNET_CLASS_ALNUM,
+	REGEXNET_CLASS_PUNCT,
+	REGEXNET_CLASS_SPACE,
+	REGEXNET_CLASS_CNTRL,
+	REGEXNET_CLASS_HIGH,			/* bytes above 0x7f */
+	REGEXNET_CLASS_END,
+};
+
+static const char *regexnet_class_names[REGEXNET_CLASS_END] = {
+	"alpha", "digit", "alnum", "punct", "space", "cntrl", "high",
+};
+
+/* The shape of a request header block, computed in one pass over it and kept
+ * for the other fetches on the same request
+ */
+struct regexnet_shape {
+	const struct stream *strm;		/* the key: stream, request, and */
+	unsigned int         uniq_id;
+	int                  eoh;		/* header block as it was measured */
+	unsigned int         bytes;		/* of header lines, without CRLF */
+	unsigned int         max_len;		/* longest header line */
+	unsigned int         max_run;		/* longest run of a single byte */
+	unsigned int         hist[256];		/* occurrences of each byte */
+	unsigned int         runs[256];		/* longest run of each byte */
+};
+
+static THREAD_LOCAL struct regexnet_shape regexnet_shape;
+
+/* The stream context, a message waiting for the server name */
+struct regexnet_ctx {
+	struct regexnet_msg *msg;
+	unsigned int         head;			/* end of the headers in msg->data */
+	unsigned int         hash;			/* picks the detector */
+};
+
+/* rand_r() state of the thread, random() would serialize them on its lock */
+static THREAD_LOCAL unsigned int regexnet_seed;
+
+/***************************************************************************
+ * Messages and detector queues
+ **************************************************************************/
+static void
+regexnet_release(struct regexnet_msg *msg)
+{
+	if (__atomic_sub_fetch(&msg->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		free(msg);
+}
+
+/* Adds <n> to a counter only its thread writes, without a locked operation */
+static inline void
+regexnet_count(unsigned long long *counter, unsigned long long n)
+{
+	__atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+/* Single-producer push (Vyukov's bounded queue, whose slot sequences need no
+ * compare-and-swap with a single producer). Returns 0 if the ring is full.
+ */
+static int
+regexnet_ring_push(struct regexnet_ring *ring, struct regexnet_msg *msg)
+{
+	unsigned int pos = ring->head;
+	struct regexnet_slot *slot = &ring->slots[pos & (ring->size - 1)];
+
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos)
+		return 0;
+	slot->msg = msg;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->head, pos + 1, __ATOMIC_RELAXED);
+	return 1;
+}
+
+/* Single-consumer pop, NULL when empty */
+static struct regexnet_msg *
+regexnet_ring_pop(struct regexnet_ring *ring)
+{
+	unsigned int pos = ring->tail;
+	struct regexnet_slot *slot = &ring->slots[pos & (ring->size - 1)];
+	struct regexnet_msg *msg;
+
+	if ((int)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (pos + 1)) < 0)
+		return NULL;
+	msg = slot->msg;
+	__atomic_store_n(&slot->seq, pos + ring->size, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->tail, pos + 1, __ATOMIC_RELAXED);
+	return msg;
+}
+
+/* Pops the next message of <det>, taking the rings in turn so that no thread
+ * starves the others. The ring it comes from is returned in <ring>. Returns
+ * NULL when they are all empty.
+ */
+static struct regexnet_msg *
+regexnet_pop(struct regexnet_detector *det, struct regexnet_ring **ring)
+{
+	struct regexnet_msg *msg;
+	int i;
+
+	for (i = 0; i < det->num_rings; i++) {
+		*ring = &det->rings[det->next_ring];
+		if (++det->next_ring == det->num_rings)
+			det->next_ring = 0;
+		msg = regexnet_ring_pop(*ring);
+		if (msg)
+			return msg;
+	}
+	return NULL;
+}
+
+/* Queues the message to <det> on the ring of the current thread, or drops it
+ * if the ring is full. Returns 0 if it was dropped.
+ */
+static int
+regexnet_push(struct regexnet_detector *det, struct regexnet_msg *msg)
+{
+	struct regexnet_ring *ring = &det->rings[tid];
+
+	if (__atomic_add_fetch(&ring->queued_bytes, msg->size, __ATOMIC_RELAXED) > REGEXNET_QUEUE_BYTES / det->num_rings ||
+	    !regexnet_ring_push(ring, msg)) {
+		__atomic_sub_fetch(&ring->queued_bytes, msg->size, __ATOMIC_RELAXED);
+		regexnet_count(&ring->num_dropped, 1);
+		regexnet_release(msg);
+		return 0;
+	}
+	regexnet_count(&ring->num_queued, 1);
+
+	if (__atomic_load_n(&det->idle, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&det->lock);
+		pthread_cond_signal(&det->cond);
+		pthread_mutex_unlock(&det->lock);
+	}
+	return 1;
+}
+
+/* Returns the detector owning <hash> on the ring, or the first one after it
+ * which is up. When they are all down, the owner keeps the message in case it
+ * comes back before its ring fills up.
+ */
+static struct regexnet_detector *
+regexnet_pick(const struct regexnet_config *conf, unsigned int hash)
+{
+	int lo = 0, hi = conf->num_points;
+	int i, mid;
+
+	/* first point at or above the hash, wrapping to the first one */
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (conf->points[mid].hash < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (i = 0; i < conf->num_points; i++) {
+		struct regexnet_detector *det = conf->points[(lo + i) % conf->num_points].det;
+
+		if (__atomic_load_n(&det->up, __ATOMIC_RELAXED))
+			return det;
+	}
+	return conf->points[lo % conf->num_points].det;
+}
+
+/* Hands the message over to the detector picked by <hash>, or to every
+ * detector with "balance all", and counts it. Never blocks. The caller's
+ * reference is consumed.
+ */
+static void
+regexnet_queue(struct regexnet_config *conf, struct regexnet_msg *msg, unsigned int hash)
+{
+	struct regexnet_counters *cnt = &conf->counters[tid];
+	struct regexnet_detector *det;
+	unsigned int size = msg->size;
+	unsigned int queued = 0, dropped = 0;
+	unsigned int length_n;
+
+	length_n = htonl(msg->size - sizeof(length_n));
+	memcpy(msg->data, &length_n, sizeof(length_n));
+
+	if (conf->balance != REGEXNET_BALANCE_ALL) {
+		msg->refs = 1;
+		if (regexnet_push(regexnet_pick(conf, hash), msg))
+			queued++;
+		else
+			dropped++;
+	}
+	else {
+		msg->refs = conf->num_detectors;
+		for (det = conf->detectors; det; det = det->next) {
+			if (regexnet_push(det, msg))
+				queued++;
+			else
+				dropped++;
+		}
+	}
+
+	/* the message may be gone already, only its size is left */
+	regexnet_count(&cnt->mirrored, 1);
+	update_freq_ctr(&cnt->mirror_rate, 1);
+	if (queued) {
+		regexnet_count(&cnt->bytes, (unsigned long long)queued * size);
+		update_freq_ctr(&cnt->bytes_rate, queued * size);
+	}
+	if (dropped) {
+		regexnet_count(&cnt->dropped, dropped);
+		update_freq_ctr(&cnt->drop_rate, dropped);
+	}
+}
+
+/* Returns the hash of the stream used to pick its detector */
+static unsigned int
+regexnet_hash(const struct regexnet_config *conf, struct stream *s)
+{
+	struct connection *conn = objt_conn(strm_orig(s));
+	const char *addr;
+	unsigned int h = 0;
+	unsigned int len, l;
+
+	if (conf->balance == REGEXNET_BALANCE_UNIQUE_ID && s->unique_id)
+		return full_hash(hash_crc32(s->unique_id, strlen(s->unique_id)));
+
+	if (!conn)
+		return 0;
+	conn_get_from_addr(conn);
+	if (conn->addr.from.ss_family == AF_INET) {
+		addr = (void *)&((struct sockaddr_in *)&conn->addr.from)->sin_addr;
+		len  = 4;
+	}
+	else if (conn->addr.from.ss_family == AF_INET6) {
+		addr = (void *)&((struct sockaddr_in6 *)&conn->addr.from)->sin6_addr;
+		len  = 16;
+	}
+	else
+		return 0;
+
+	for (l = 0; l + sizeof(int) <= len; l += sizeof(int))
+		h ^= ntohl(*(unsigned int *)(&addr[l]));
+	return full_hash(h);
+}
+
+/***************************************************************************
+ * Sender threads
+ **************************************************************************/
+static int
+regexnet_connect(struct regexnet_detector *det)
+{
+	int fd;
+
+	if ((fd = socket(det->addr.ss_family, SOCK_STREAM, 0)) < 0)
+		return -1;
+	if (connect(fd, (struct sockaddr *)&det->addr, get_addr_len(&det->addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Writes the whole buffer, resuming after short writes. Returns 0 on error. */
+static int
+regexnet_write_all(int fd, const char *data, unsigned int length)
+{
+	while (length > 0) {
+		ssize_t ret = send(fd, data, length, MSG_NOSIGNAL);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return 0;
+		}
+		data += ret;
+		length -= ret;
+	}
+	return 1;
+}
+
+/* Sleeps at most <us> microseconds, or until messages are queued or the
+ * detector is stopped.
+ */
+static void
+regexnet_wait(struct regexnet_detector *det, unsigned int us)
+{
+	struct timespec deadline;
+
+	/* producers signal only while this flag is set, and the timed wait
+	 * covers a push racing with it
+	 */
+	__atomic_store_n(&det->idle, 1, __ATOMIC_SEQ_CST);
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec  += us / 1000000;
+	deadline.tv_nsec += (us % 1000000) * 1000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec += 1;
+		deadline.tv_nsec -= 1000000000L;
+	}
+	pthread_mutex_lock(&det->lock);
+	if (!det->stopping)
+		pthread_cond_timedwait(&det->cond, &det->lock, &deadline);
+	pthread_mutex_unlock(&det->lock);
+	__atomic_store_n(&det->idle, 0, __ATOMIC_SEQ_CST);
+}
+
+static void *
+regexnet_sender(void *arg)
+{
+	struct regexnet_detector *det = arg;
+	unsigned int backoff = REGEXNET_RETRY_MIN_US;
+	struct regexnet_ring *ring;
+	struct regexnet_msg *msg;
+
+	while (!__atomic_load_n(&det->stopping, __ATOMIC_ACQUIRE)) {
+		if (det->fd < 0) {
+			det->fd = regexnet_connect(det);
+			if (det->fd < 0) {
+				/* new messages fail over to the other detectors, the
+				 * ring keeps those queued already
+				 */
+				if (__atomic_exchange_n(&det->up, 0, __ATOMIC_RELAXED)) {
+					tv_update_date(-1, -1);
+					ha_warning("regexnet-mirror: detector %s is DOWN: %s\n",
+						   det->id, strerror(errno));
+				}
+				regexnet_wait(det, backoff);
+				backoff = backoff * 2 > REGEXNET_RETRY_MAX_US ? REGEXNET_RETRY_MAX_US : backoff * 2;
+				continue;
+			}
+			if (!__atomic_exchange_n(&det->up, 1, __ATOMIC_RELAXED)) {
+				tv_update_date(-1, -1);
+				ha_warning("regexnet-mirror: detector %s is UP\n", det->id);
+			}
+			backoff = REGEXNET_RETRY_MIN_US;
+		}
+
+		msg = regexnet_pop(det, &ring);
+		if (!msg) {
+			regexnet_wait(det, REGEXNET_IDLE_MS * 1000);
+			continue;
+		}
+
+		if (regexnet_write_all(det->fd, msg->data, msg->size))
+			regexnet_count(&det->num_sent, 1);
+		else {
+			/* the message is lost rather than resumed on a new connection */
+			tv_update_date(-1, -1);
+			ha_warning("regexnet-mirror: send to detector %s failed: %s\n",
+				   det->id, strerror(errno));
+			close(det->fd);
+			det->fd = -1;
+			regexnet_count(&det->num_dropped, 1);
+		}
+		__atomic_sub_fetch(&ring->queued_bytes, msg->size, __ATOMIC_RELAXED);
+		regexnet_release(msg);
+	}
+
+	while ((msg = regexnet_pop(det, &ring)))
+		regexnet_release(msg);
+	if (det->fd >= 0)
+		close(det->fd);
+	det->fd = -1;
+	return NULL;
+}
+
+static void
+regexnet_stop(struct regexnet_detector *det)
+{
+	if (!det->started)
+		return;
+	pthread_mutex_lock(&det->lock);
+	__atomic_store_n(&det->stopping, 1, __ATOMIC_RELEASE);
+	pthread_cond_signal(&det->cond);
+	pthread_mutex_unlock(&det->lock);
+	pthread_join(det->thread, NULL);
+	det->started = 0;
+}
+
+static void
+regexnet_free_detectors(struct regexnet_detector *det)
+{
+	struct regexnet_detector *next;
+	int i;
+
+	for (; det; det = next) {
+		next = det->next;
+		regexnet_stop(det);
+		pthread_mutex_destroy(&det->lock);
+		pthread_cond_destroy(&det->cond);
+		for (i = 0; det->rings && i < det->num_rings; i++)
+			free(det->rings[i].slots);
+		free(det->rings);
+		free(det->id);
+		free(det);
+	}
+}
+
+/***************************************************************************
+ * Building the messages
+ **************************************************************************/
+/* Copies <length> bytes starting at <from> out of <buf>, which may wrap */
+static void
+regexnet_copy_block(char *out, const struct buffer *buf, const char *from, unsigned int length)
+{
+	unsigned int first = buf->data + buf->size - from;
+
+	if (first > length)
+		first = length;
+	memcpy(out, from, first);
+	memcpy(out + first, buf->data, length - first);
+}
+
+/* Returns non-zero if the header named <name> of <len> bytes is allowed */
+static int
+regexnet_header_allowed(const struct regexnet_config *conf, const char *name, int len)
+{
+	const struct regexnet_header *hdr;
+
+	if (!conf->headers)
+		return 1;
+	for (hdr = conf->headers; hdr; hdr = hdr->next) {
+		if (len == hdr->len && strncasecmp(name, hdr->name, len) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+/* Same for the header line <line> of <len> bytes */
+static int
+regexnet_line_allowed(const struct regexnet_config *conf, const char *line, int len)
+{
+	const char *colon = memchr(line, ':', len);
+
+	return regexnet_header_allowed(conf, line, colon ? colon - line : len);
+}
+
+/* Copies the request of <txn> into a new message: its request line, the
+ * allowed headers as rewritten by the rules, and at most conf->max_bytes of the
+ * body that already arrived. The end of the headers is returned in <head> so
+ * that one can still be inserted. Returns NULL if out of memory.
+ */
+static struct regexnet_msg *
+regexnet_build(const struct regexnet_config *conf, struct http_txn *txn, unsigned int *head)
+{
+	struct http_msg *msg = &txn->req;
+	struct buffer *buf = msg->chn->buf;
+	int rewind = http_hdr_rewind(msg);
+	const char *start = b_ptr(buf, -rewind);
+	unsigned int headers, body, length;
+	struct regexnet_msg *out;
+	struct hdr_idx_elem *cur_hdr;
+	const char *cur_ptr;
+	char *p;
+	int cur_idx;
+
+	headers = msg->eoh + msg->eol;
+	body = rewind + buf->i > headers ? rewind + buf->i - headers : 0;
+	if (body > conf->max_bytes)
+		body = conf->max_bytes;
+
+	/* the header block is contiguous until it is forwarded, which happens
+	 * only after the inner HTTP analyser
+	 */
+	if (!conf->headers)
+		length = msg->eoh;
+	else {
+		length = hdr_idx_first_pos(&txn->hdr_idx);
+		cur_ptr = start + length;
+		for (cur_idx = txn->hdr_idx.v[0].next; cur_idx; cur_idx = cur_hdr->next) {
+			cur_hdr = &txn->hdr_idx.v[cur_idx];
+			if (regexnet_line_allowed(conf, cur_ptr, cur_hdr->len))
+				length += cur_hdr->len + cur_hdr->cr + 1;
+			cur_ptr += cur_hdr->len + cur_hdr->cr + 1;
+		}
+	}
+	*head = sizeof(unsigned int) + length;
+	length += msg->eol + body;
+
+	out = malloc(sizeof(*out) + sizeof(unsigned int) + length);
+	if (!out)
+		return NULL;
+	out->size = sizeof(unsigned int) + length;
+	p = out->data + sizeof(unsigned int);
+
+	if (!conf->headers) {
+		memcpy(p, start, msg->eoh);
+		p += msg->eoh;
+	}
+	else {
+		memcpy(p, start, hdr_idx_first_pos(&txn->hdr_idx));
+		p += hdr_idx_first_pos(&txn->hdr_idx);
+		cur_ptr = start + hdr_idx_first_pos(&txn->hdr_idx);
+		for (cur_idx = txn->hdr_idx.v[0].next; cur_idx; cur_idx = cur_hdr->next) {
+			cur_hdr = &txn->hdr_idx.v[cur_idx];
+			if (regexnet_line_allowed(conf, cur_ptr, cur_hdr->len)) {
+				memcpy(p, cur_ptr, cur_hdr->len + cur_hdr->cr + 1);
+				p += cur_hdr->len + cur_hdr->cr + 1;
+			}
+			cur_ptr += cur_hdr->len + cur_hdr->cr + 1;
+		}
+	}
+	memcpy(p, start + msg->eoh, msg->eol);
+	p += msg->eol;
+	regexnet_copy_block(p, buf, b_ptr(buf, (int)headers - rewind), body);
+	return out;
+}
+
+/* Inserts the header "<name>: <value>\r\n" at offset <head> of <msg>. Returns
+ * the message, which may have moved, or NULL if out of memory.
+ */
+static struct regexnet_msg *
+regexnet_add_header(struct regexnet_msg *msg, unsigned int head,
+		    const char *name, int name_len, const char *value)
+{
+	int value_len = strlen(value);
+	unsigned int line = name_len + 2 + value_len + 2;
+	struct regexnet_msg *out;
+	char *p;
+
+	out = realloc(msg, sizeof(*msg) + msg->size + line);
+	if (!out) {
+		free(msg);
+		return NULL;
+	}
+	p = out->data + head;
+	memmove(p + line, p, out->size - head);
+	memcpy(p, name, name_len);
+	p += name_len;
+	memcpy(p, ": ", 2);
+	p += 2;
+	memcpy(p, value, value_len);
+	p += value_len;
+	memcpy(p, "\r\n", 2);
+	out->size += line;
+	return out;
+}
+
+static int
+regexnet_cmp_points(const void *a, const void *b)
+{
+	unsigned int ha = ((const struct regexnet_point *)a)->hash;
+	unsigned int hb = ((const struct regexnet_point *)b)->hash;
+
+	return ha < hb ? -1 : ha > hb;
+}
+
+/* Places REGEXNET_CHASH_POINTS points per detector on the hash ring. They only
+ * depend on the detector address, so a detector keeps its share of the ring
+ * whatever the others are. Returns -1 if out of memory, else 0.
+ */
+static int
+regexnet_build_points(struct regexnet_config *conf)
+{
+	struct regexnet_detector *det;
+	int i, n = 0;
+
+	conf->points = calloc(conf->num_detectors * REGEXNET_CHASH_POINTS, sizeof(*conf->points));
+	if (!conf->points)
+		return -1;
+	for (det = conf->detectors; det; det = det->next) {
+		unsigned int h = hash_crc32(det->id, strlen(det->id));
+
+		for (i = 0; i < REGEXNET_CHASH_POINTS; i++) {
+			conf->points[n].hash = full_hash(h + i);
+			conf->points[n].det  = det;
+			n++;
+		}
+	}
+	conf->num_points = n;
+	qsort(conf->points, n, sizeof(*conf->points), regexnet_cmp_points);
+	return 0;
+}
+
+/***************************************************************************
+ * Hooks that manage the filter lifecycle (init/check/deinit)
+ **************************************************************************/
+/* Initialize the filter. Returns -1 on error, else 0. */
+static int
+regexnet_init(struct proxy *px, struct flt_conf *fconf)
+{
+	struct regexnet_config *conf = fconf->conf;
+	struct regexnet_detector *det;
+	struct regexnet_ring *ring;
+	unsigned int ring_size, i;
+	int t;
+
+	if (conf->name)
+		memprintf(&conf->name, "%s/%s", conf->name, px->id);
+	else
+		memprintf(&conf->name, "REGEXNET/%s", px->id);
+
+	if (posix_memalign((void **)&conf->counters, REGEXNET_CACHELINE,
+			   global.nbthread * sizeof(*conf->counters)) != 0) {
+		conf->counters = NULL;
+		goto oom;
+	}
+	memset(conf->counters, 0, global.nbthread * sizeof(*conf->counters));
+
+	/* the threads share the queue size of each detector */
+	ring_size = (conf->queue_size + global.nbthread - 1) / global.nbthread;
+	while (ring_size & (ring_size - 1))
+		ring_size++;
+
+	for (det = conf->detectors; det; det = det->next) {
+		if (posix_memalign((void **)&det->rings, REGEXNET_CACHELINE,
+				   global.nbthread * sizeof(*det->rings)) != 0) {
+			det->rings = NULL;
+			goto oom;
+		}
+		memset(det->rings, 0, global.nbthread * sizeof(*det->rings));
+		det->num_rings = global.nbthread;
+		for (t = 0; t < det->num_rings; t++) {
+			ring = &det->rings[t];
+			ring->size = ring_size;
+			ring->slots = calloc(ring->size, sizeof(*ring->slots));
+			if (!ring->slots)
+				goto oom;
+			for (i = 0; i < ring->size; i++)
+				ring->slots[i].seq = i;
+		}
+	}
+
+	if (conf->balance != REGEXNET_BALANCE_ALL &&
+	    regexnet_build_points(conf) < 0)
+		goto oom;
+	fconf->conf = conf;
+	return 0;
+
+ oom:
+	ha_alert("config: %s '%s': out of memory\n",
+		 proxy_type_str(px), px->id);
+	return -1;
+}
+
+/* Free ressources allocated by the filter, once its senders are stopped. */
+static void
+regexnet_deinit(struct proxy *px, struct flt_conf *fconf)
+{
+	struct regexnet_config *conf = fconf->conf;
+	struct regexnet_header *hdr, *next;
+
+	if (conf) {
+		regexnet_free_detectors(conf->detectors);
+		free(conf->points);
+		free(conf->counters);
+		if (conf->cond) {
+			prune_acl_cond(conf->cond);
+			free(conf->cond);
+		}
+		for (hdr = conf->headers; hdr; hdr = next) {
+			next = hdr->next;
+			free(hdr->name);
+			free(hdr);
+		}
+		free(conf->name);
+		free(conf);
+	}
+	fconf->conf = NULL;
+}
+
+/* Check configuration of the filter for a specified proxy.
+ * Return 1 on error, else 0. */
+static int
+regexnet_check(struct proxy *px, struct flt_conf *fconf)
+{
+	if (px->mode != PR_MODE_HTTP) {
+		ha_alert("config: %s '%s': regexnet-mirror filter requires HTTP mode\n",
+			 proxy_type_str(px), px->id);
+		return 1;
+	}
+	return 0;
+}
+
+/* Starts the senders from the first thread, once the process is forked and
+ * before any request is processed. Return -1 on error, else 0. */
+static int
+regexnet_init_per_thread(struct proxy *px, struct flt_conf *fconf)
+{
+	struct regexnet_config *conf = fconf->conf;
+	struct regexnet_detector *det;
+
+	if (!regexnet_seed)
+		regexnet_seed = random() + tid + 1;
+	if (tid != 0)
+		return 0;
+	for (det = conf->detectors; det; det = det->next) {
+		if (pthread_create(&det->thread, NULL, regexnet_sender, det) != 0) {
+			ha_alert("%s: cannot start the sender to detector %s\n",
+				 conf->name, det->id);
+			return -1;
+		}
+		det->started = 1;
+	}
+	return 0;
+}
+
+/**************************************************************************
+ * Hooks to handle start/stop of streams
+ *************************************************************************/
+/* Called when a filter instance is detach from a stream, just before its
+ * destruction */
+static void
+regexnet_detach(struct stream *s, struct filter *filter)
+{
+	struct regexnet_ctx *ctx = filter->ctx;
+
+	/* the server was never reached, there is nobody to warn */
+	if (ctx) {
+		free(ctx->msg);
+		free(ctx);
+	}
+	filter->ctx = NULL;
+}
+
+/**************************************************************************
+ * Hooks to handle channels activity
+ *************************************************************************/
+/* Called when analyze starts for a given channel. The request is mirrored
+ * once the inner HTTP analyser is done with it, which is when the rules and
+ * "option forwardfor" have all rewritten the header block. On the response
+ * channel, the server connection is established.
+ */
+static int
+regexnet_chn_start_analyze(struct stream *s, struct filter *filter,
+			   struct channel *chn)
+{
+	struct regexnet_config *conf = FLT_CONF(filter);
+	struct regexnet_ctx *ctx = filter->ctx;
+	struct server *srv;
+
+	if (!(chn->flags & CF_ISRESP)) {
+		filter->post_analyzers |= AN_REQ_HTTP_INNER;
+		return 1;
+	}
+
+	if (!ctx || !ctx->msg)
+		return 1;
+	srv = objt_server(s->target);
+	if (srv)
+		ctx->msg = regexnet_add_header(ctx->msg, ctx->head, s->be->server_id_hdr_name,
+					       s->be->server_id_hdr_len, srv->id);
+	if (ctx->msg)
+		regexnet_queue(conf, ctx->msg, ctx->hash);
+	ctx->msg = NULL;
+	return 1;
+}
+
+/* Called after a processing happens on a given channel */
+static int
+regexnet_chn_post_analyze(struct stream *s, struct filter *filter,
+			  struct channel *chn, unsigned an_bit)
+{
+	struct regexnet_config *conf = FLT_CONF(filter);
+	struct regexnet_ctx *ctx = filter->ctx;
+	struct regexnet_msg *msg;
+	unsigned int head;
+
+	if (an_bit != AN_REQ_HTTP_INNER || !s->txn)
+		return 1;
+
+	if (conf->sample_below && rand_r(&regexnet_seed) >= conf->sample_below)
+		return 1;
+
+	if (conf->cond) {
+		int ret = acl_exec_cond(conf->cond, s->be, s->sess, s, SMP_OPT_DIR_REQ|SMP_OPT_FINAL);
+
+		ret = acl_pass(ret);
+		if (conf->cond->pol == ACL_COND_UNLESS)
+			ret = !ret;
+		if (!ret)
+			return 1;
+	}
+
+	msg = regexnet_build(conf, s->txn, &head);
+	if (!msg)
+		return 1;
+
+	if (!s->be->server_id_hdr_name ||
+	    !regexnet_header_allowed(conf, s->be->server_id_hdr_name, s->be->server_id_hdr_len)) {
+		regexnet_queue(conf, msg, regexnet_hash(conf, s));
+		return 1;
+	}
+
+	/* the server name is only known once the connection is established */
+	if (!ctx) {
+		ctx = calloc(1, sizeof(*ctx));
+		if (!ctx) {
+			free(msg);
+			return 1;
+		}
+		filter->ctx = ctx;
+	}
+	free(ctx->msg);
+	ctx->msg = msg;
+	ctx->head = head;
+	ctx->hash = regexnet_hash(conf, s);
+	return 1;
+}
+
+/********************************************************************
+ * Functions that manage the filter initialization
+ ********************************************************************/
+struct flt_ops regexnet_ops = {
+	/* Manage the filter, called for each filter declaration */
+	.init              = regexnet_init,
+	.deinit            = regexnet_deinit,
+	.check             = regexnet_check,
+	.init_per_thread   = regexnet_init_per_thread,
+
+	/* Handle start/stop of streams */
+	.detach            = regexnet_detach,
+
+	/* Handle channels activity */
+	.channel_start_analyze = regexnet_chn_start_analyze,
+	.channel_post_analyze  = regexnet_chn_post_analyze,
+};
+
+/* Parses "filter regexnet-mirror [name <name>] detector <addr:port> ...
+ *   [balance src|unique-id|all] [sample <ratio>] [max-bytes <size>]
+ *   [header <name> ...] [queue-size <n>] [{ if | unless } <condition>]"
+ * Return -1 on error, else 0 */
+static int
+parse_regexnet_flt(char **args, int *cur_arg, struct proxy *px,
+		   struct flt_conf *fconf, char **err, void *private)
+{
+	struct regexnet_config   *conf;
+	struct regexnet_detector *det, **last_det;
+	struct regexnet_header   *hdr, **last_hdr;
+	struct sockaddr_storage  *sk;
+	const char               *res;
+	char                     *end;
+	int                       port1, port2;
+	int                       pos = *cur_arg + 1;
+
+	conf = calloc(1, sizeof(*conf));
+	if (!conf) {
+		memprintf(err, "%s: out of memory", args[*cur_arg]);
+		return -1;
+	}
+	conf->proxy      = px;
+	conf->sample     = 1.0;
+	conf->max_bytes  = REGEXNET_MAX_BYTES;
+	conf->queue_size = REGEXNET_QUEUE_SIZE;
+	last_det = &conf->detectors;
+	last_hdr = &conf->headers;
+
+	while (*args[pos]) {
+		if (!strcmp(args[pos], "name") || !strcmp(args[pos], "detector") ||
+		    !strcmp(args[pos], "balance") || !strcmp(args[pos], "sample") || !strcmp(args[pos], "max-bytes") ||
+		    !strcmp(args[pos], "header") || !strcmp(args[pos], "queue-size")) {
+			if (!*args[pos + 1]) {
+				memprintf(err, "'%s' : '%s' option without value",
+					  args[*cur_arg], args[pos]);
+				goto error;
+			}
+		}
+		else if (!strcmp(args[pos], "if") || !strcmp(args[pos], "unless")) {
+			/* the condition runs up to the end of the line */
+			conf->cond = build_acl_cond(px->conf.args.file, px->conf.args.line, &px->acl, px,
+						    (const char **)args + pos, err);
+			if (!conf->cond) {
+				memprintf(err, "'%s' : error detected while parsing the condition : %s",
+					  args[*cur_arg], *err);
+				goto error;
+			}
+			if (!(conf->cond->val & ((px->cap & PR_CAP_BE) ? SMP_VAL_BE_HRQ_HDR : SMP_VAL_FE_HRQ_HDR))) {
+				memprintf(err, "'%s' : the condition must only use fetches available on the request headers",
+					  args[*cur_arg]);
+				goto error;
+			}
+			while (*args[pos])
+				pos++;
+			break;
+		}
+		else
+			break;
+
+		if (!strcmp(args[pos], "name")) {
+			free(conf->name);
+			conf->name = strdup(args[pos + 1]);
+			if (!conf->name) {
+				memprintf(err, "%s: out of memory", args[*cur_arg]);
+				goto error;
+			}
+		}
+		else if (!strcmp(args[pos], "detector")) {
+			sk = str2sa_range(args[pos + 1], NULL, &port1, &port2, err, NULL, NULL, 1);
+			if (!sk) {
+				memprintf(err, "'%s' : '%s %s' : %s",
+					  args[*cur_arg], args[pos], args[pos + 1], *err);
+				goto error;
+			}
+			if (!is_inet_addr(sk) || port1 != port2 || !port1) {
+				memprintf(err, "'%s' : '%s' expects an IPv4 or IPv6 address with a port, got '%s'",
+					  args[*cur_arg], args[pos], args[pos + 1]);
+				goto error;
+			}
+			det = calloc(1, sizeof(*det));
+			if (!det || (det->id = strdup(args[pos + 1])) == NULL) {
+				free(det);
+				memprintf(err, "%s: out of memory", args[*cur_arg]);
+				goto error;
+			}
+			det->addr = *sk;
+			det->fd   = -1;
+			det->up   = 1;
+			pthread_mutex_init(&det->lock, NULL);
+			pthread_cond_init(&det->cond, NULL);
+			*last_det = det;
+			last_det = &det->next;
+			conf->num_detectors++;
+		}
+		else if (!strcmp(args[pos], "balance")) {
+			if (!strcmp(args[pos + 1], "src"))
+				conf->balance = REGEXNET_BALANCE_SRC;
+			else if (!strcmp(args[pos + 1], "unique-id"))
+				conf->balance = REGEXNET_BALANCE_UNIQUE_ID;
+			else if (!strcmp(args[pos + 1], "all"))
+				conf->balance = REGEXNET_BALANCE_ALL;
+			else {
+				memprintf(err, "'%s' : '%s' expects 'src', 'unique-id' or 'all', got '%s'",
+					  args[*cur_arg], args[pos], args[pos + 1]);
+				goto error;
+			}
+		}
+		else if (!strcmp(args[pos], "sample")) {
+			conf->sample = strtod(args[pos + 1], &end);
+			if (*end || !(conf->sample > 0.0 && conf->sample <= 1.0)) {
+				memprintf(err, "'%s' : '%s' expects a ratio in ]0,1], got '%s'",
+					  args[*cur_arg], args[pos], args[pos + 1]);
+				goto error;
+			}
+		}
+		else if (!strcmp(args[pos], "max-bytes")) {
+			res = parse_size_err(args[pos + 1], &conf->max_bytes);
+			if (res) {
+				memprintf(err, "'%s' : unexpected character '%c' in '%s' argument",
+					  args[*cur_arg], *res, args[pos]);
+				goto error;
+			}
+		}
+		else if (!strcmp(args[pos], "header")) {
+			hdr = calloc(1, sizeof(*hdr));
+			if (!hdr || (hdr->name = strdup(args[pos + 1])) == NULL) {
+				free(hdr);
+				memprintf(err, "%s: out of memory", args[*cur_arg]);
+				goto error;
+			}
+			hdr->len = strlen(hdr->name);
+			*last_hdr = hdr;
+			last_hdr = &hdr->next;
+		}
+		else if (!strcmp(args[pos], "queue-size")) {
+			conf->queue_size = strtol(args[pos + 1], &end, 10);
+			if (*end || conf->queue_size < 1 || conf->queue_size > REGEXNET_QUEUE_MAX) {
+				memprintf(err, "'%s' : '%s' expects a number of messages between 1 and %d, got '%s'",
+					  args[*cur_arg], args[pos], REGEXNET_QUEUE_MAX, args[pos + 1]);
+				goto error;
+			}
+			/* the ring indexes are masked */
+			while (conf->queue_size & (conf->queue_size - 1))
+				conf->queue_size++;
+		}
+		pos += 2;
+	}
+
+	if (!conf->detectors) {
+		memprintf(err, "'%s' : at least one 'detector' is required", args[*cur_arg]);
+		goto error;
+	}
+	if (conf->sample < 1.0) {
+		conf->sample_below = conf->sample * ((double)RAND_MAX + 1.0);
+		if (!conf->sample_below)
+			conf->sample_below = 1;
+	}
+
+	*cur_arg    = pos;
+	fconf->id   = regexnet_flt_id;
+	fconf->ops  = &regexnet_ops;
+	fconf->conf = conf;
+	return 0;
+
+ error:
+	regexnet_free_detectors(conf->detectors);
+	if (conf->cond) {
+		prune_acl_cond(conf->cond);
+		free(conf->cond);
+	}
+	for (hdr = conf->headers; hdr; hdr = conf->headers) {
+		conf->headers = hdr->next;
+		free(hdr->name);
+		free(hdr);
+	}
+	free(conf->name);
+	free(conf);
+	return -1;
+}
+
+/********************************************************************
+ * Statistics
+ ********************************************************************/
+/* Returns the configuration of <fconf> if it is a regexnet-mirror filter */
+static struct regexnet_config *
+regexnet_conf(const struct flt_conf *fconf)
+{
+	return fconf->id == regexnet_flt_id ? fconf->conf : NULL;
+}
+
+/* Sums the messages waiting in the rings of <det> into <msgs> and <bytes> */
+static void
+regexnet_det_queued(const struct regexnet_detector *det,
+		    unsigned long long *msgs, unsigned long long *bytes)
+{
+	const struct regexnet_ring *ring;
+	unsigned int tail;
+	int i;
+
+	for (i = 0; i < det->num_rings; i++) {
+		ring = &det->rings[i];
+		/* the tail first, it never passes the head read after it */
+		tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		*msgs  += __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail;
+		*bytes += __atomic_load_n(&ring->queued_bytes, __ATOMIC_RELAXED);
+	}
+}
+
+/* Adds the counters of all threads of <conf> to <t> */
+static void
+regexnet_sum(struct regexnet_config *conf, struct regexnet_totals *t)
+{
+	struct regexnet_counters *cnt;
+	struct regexnet_detector *det;
+	unsigned long long bytes = 0;
+	int i;
+
+	for (i = 0; i < global.nbthread; i++) {
+		cnt = &conf->counters[i];
+		t->mirrored    += __atomic_load_n(&cnt->mirrored, __ATOMIC_RELAXED);
+		t->bytes       += __atomic_load_n(&cnt->bytes, __ATOMIC_RELAXED);
+		t->dropped     += __atomic_load_n(&cnt->dropped, __ATOMIC_RELAXED);
+		t->mirror_rate += read_freq_ctr(&cnt->mirror_rate);
+		t->bytes_rate  += read_freq_ctr(&cnt->bytes_rate);
+		t->drop_rate   += read_freq_ctr(&cnt->drop_rate);
+	}
+	for (det = conf->detectors; det; det = det->next)
+		regexnet_det_queued(det, &t->queued, &bytes);
+}
+
+/* Fills the regexnet fields of "show info" with the sums over all the
+ * regexnet-mirror filters of the process
+ */
+void
+regexnet_fill_info(struct field *info)
+{
+	struct regexnet_totals t = { };
+	struct regexnet_config *conf;
+	struct flt_conf *fconf;
+	struct proxy *px;
+
+	for (px = proxies_list; px; px = px->next) {
+		list_for_each_entry(fconf, &px->filter_configs, list) {
+			if ((conf = regexnet_conf(fconf)) != NULL)
+				regexnet_sum(conf, &t);
+		}
+	}
+	info[INF_REGEXNET_MIRRORED]    = mkf_u64(FN_COUNTER, t.mirrored);
+	info[INF_REGEXNET_MIRROR_RATE] = mkf_u32(FN_RATE, t.mirror_rate);
+	info[INF_REGEXNET_MIRROR_BPS]  = mkf_u32(FN_RATE, t.bytes_rate);
+	info[INF_REGEXNET_DROPPED]     = mkf_u64(FN_COUNTER, t.dropped);
+	info[INF_REGEXNET_DROP_RATE]   = mkf_u32(FN_RATE, t.drop_rate);
+	info[INF_REGEXNET_QUEUED]      = mkf_u64(0, t.queued);
+}
+
+/* Fills the mirror fields of "show stat" for <px>, which are left empty when
+ * it has no regexnet-mirror filter
+ */
+void
+regexnet_fill_stats(struct proxy *px, struct field *stats)
+{
+	struct regexnet_totals t = { };
+	struct regexnet_config *conf;
+	struct flt_conf *fconf;
+	int found = 0;
+
+	list_for_each_entry(fconf, &px->filter_configs, list) {
+		if ((conf = regexnet_conf(fconf)) != NULL) {
+			regexnet_sum(conf, &t);
+			found = 1;
+		}
+	}
+	if (!found)
+		return;
+	stats[ST_F_MIRROR_REQ]   = mkf_u64(FN_COUNTER, t.mirrored);
+	stats[ST_F_MIRROR_RATE]  = mkf_u32(FN_RATE, t.mirror_rate);
+	stats[ST_F_MIRROR_BYTES] = mkf_u64(FN_COUNTER, t.bytes);
+	stats[ST_F_MIRROR_DROP]  = mkf_u64(FN_COUNTER, t.dropped);
+	stats[ST_F_MIRROR_QCUR]  = mkf_u64(0, t.queued);
+}
+
+/* Parses "show regexnet", which dumps the counters of every regexnet-mirror
+ * filter and of its detectors
+ */
+static int
+cli_parse_show_regexnet(char **args, struct appctx *appctx, void *private)
+{
+	appctx->ctx.cli.p0 = proxies_list;
+	return 0;
+}
+
+/* Dumps the filters of one proxy at a time, resuming at the proxy in
+ * appctx->ctx.cli.p0. Returns 0 while the output is incomplete.
+ */
+static int
+cli_io_handler_show_regexnet(struct appctx *appctx)
+{
+	struct stream_interface *si = appctx->owner;
+	struct regexnet_config *conf;
+	struct regexnet_detector *det;
+	struct regexnet_totals t;
+	struct flt_conf *fconf;
+	struct proxy *px;
+	unsigned long long msgs, bytes, queued, dropped;
+	int i;
+
+	for (; appctx->ctx.cli.p0 != NULL; appctx->ctx.cli.p0 = px->next) {
+		px = appctx->ctx.cli.p0;
+		chunk_reset(&trash);
+
+		list_for_each_entry(fconf, &px->filter_configs, list) {
+			if ((conf = regexnet_conf(fconf)) == NULL)
+				continue;
+
+			memset(&t, 0, sizeof(t));
+			regexnet_sum(conf, &t);
+			chunk_appendf(&trash, "# filter: %s, mirrored: %llu (%u/s), bytes: %llu (%u/s), dropped: %llu (%u/s), queued: %llu\n",
+				      conf->name, t.mirrored, t.mirror_rate, t.bytes, t.bytes_rate,
+				      t.dropped, t.drop_rate, t.queued);
+
+			for (det = conf->detectors; det; det = det->next) {
+				msgs = bytes = queued = dropped = 0;
+				regexnet_det_queued(det, &msgs, &bytes);
+				for (i = 0; i < det->num_rings; i++) {
+					queued  += __atomic_load_n(&det->rings[i].num_queued, __ATOMIC_RELAXED);
+					dropped += __atomic_load_n(&det->rings[i].num_dropped, __ATOMIC_RELAXED);
+				}
+				chunk_appendf(&trash, "detector %s: status=%s qcur=%llu qbytes=%llu queued=%llu sent=%llu dropped=%llu lost=%llu\n",
+					      det->id, __atomic_load_n(&det->up, __ATOMIC_RELAXED) ? "UP" : "DOWN",
+					      msgs, bytes, queued,
+					      __atomic_load_n(&det->num_sent, __ATOMIC_RELAXED), dropped,
+					      __atomic_load_n(&det->num_dropped, __ATOMIC_RELAXED));
+			}
+		}
+
+		if (ci_putchk(si_ic(si), &trash) == -1) {
+			si_applet_cant_put(si);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/********************************************************************
+ * Sample fetches on the shape of the request headers
+ ********************************************************************/
+/* Measures the header lines of the request of <txn>, unless this was already
+ * done for it. The block is read once; the byte histogram and the longest run
+ * of each byte answer all the fetches, whatever their arguments.
+ */
+static const struct regexnet_shape *
+regexnet_get_shape(struct stream *s, struct http_txn *txn)
+{
+	struct regexnet_shape *shape = &regexnet_shape;
+	struct http_msg *msg = &txn->req;
+	struct hdr_idx *idx = &txn->hdr_idx;
+	struct hdr_idx_elem *cur_hdr;
+	const unsigned char *cur_ptr, *p, *end;
+	unsigned int run;
+	int cur_idx;
+
+	if (shape->strm == s && shape->uniq_id == s->uniq_id && shape->eoh == msg->eoh)
+		return shape;
+
+	memset(shape, 0, sizeof(*shape));
+	shape->strm    = s;
+	shape->uniq_id = s->uniq_id;
+	shape->eoh     = msg->eoh;
+
+	cur_ptr = (const unsigned char *)msg->chn->buf->p + hdr_idx_first_pos(idx);
+	for (cur_idx = idx->v[0].next; cur_idx; cur_idx = cur_hdr->next) {
+		cur_hdr = &idx->v[cur_idx];
+		end = cur_ptr + cur_hdr->len;
+
+		if (cur_hdr->len > shape->max_len)
+			shape->max_len = cur_hdr->len;
+		shape->bytes += cur_hdr->len;
+
+		/* runs do not span lines */
+		run = 0;
+		for (p = cur_ptr; p < end; p++) {
+			shape->hist[*p]++;
+			run = (p > cur_ptr && p[-1] == *p) ? run + 1 : 1;
+			if (run > shape->runs[*p])
+				shape->runs[*p] = run;
+		}
+		cur_ptr = end + cur_hdr->cr + 1;
+	}
+
+	for (run = 0; run < 256; run++) {
+		if (shape->runs[run] > shape->max_run)
+			shape->max_run = shape->runs[run];
+	}
+	return shape;
+}
+
+static int
+regexnet_in_class(int c, enum regexnet_class class)
+{
+	switch (class) {
+	case REGEXNET_CLASS_ALPHA: return c < 0x80 && isalpha(c);
+	case REGEXNET_CLASS_DIGIT: return c < 0x80 && isdigit(c);
+	case REGEXNET_CLASS_ALNUM: return c < 0x80 && isalnum(c);
+	case REGEXNET_CLASS_PUNCT: return c < 0x80 && ispunct(c);
+	case REGEXNET_CLASS_SPACE: return c < 0x80 && isspace(c);
+	case REGEXNET_CLASS_CNTRL: return c < 0x80 && iscntrl(c);
+	case REGEXNET_CLASS_HIGH:  return c >= 0x80;
+	default:                   return 0;
+	}
+}
+
+/* Returns the length of the longest request header line, name included */
+static int
+smp_fetch_hdr_maxlen(const struct arg *args, struct sample *smp, const char *kw, void *private)
+{
+	const struct regexnet_shape *shape;
+
+	CHECK_HTTP_MESSAGE_FIRST();
+
+	shape = regexnet_get_shape(smp->strm, smp->strm->txn);
+	smp->data.type = SMP_T_SINT;
+	smp->data.u.sint = shape->max_len;
+	smp->flags = SMP_F_VOL_HDR;
+	return 1;
+}
+
+/* Returns the longest run of the character given in argument in the request
+ * header lines, or of any single character without argument.
+ */
+static int
+smp_fetch_hdr_maxrun(const struct arg *args, struct sample *smp, const char *kw, void *private)
+{
+	const struct regexnet_shape *shape;
+
+	CHECK_HTTP_MESSAGE_FIRST();
+
+	shape = regexnet_get_shape(smp->strm, smp->strm->txn);
+	smp->data.type = SMP_T_SINT;
+	if (args && args[0].type == ARGT_STR)
+		smp->data.u.sint = shape->runs[(unsigned char)args[0].data.str.str[0]];
+	else
+		smp->data.u.sint = shape->max_run;
+	smp->flags = SMP_F_VOL_HDR;
+	return 1;
+}
+
+/* Returns the percentage of the bytes of the request header lines which are
+ * in the class given in argument, "punct" by default.
+ */
+static int
+smp_fetch_hdr_charclass_ratio(const struct arg *args, struct sample *smp, const char *kw, void *private)
+{
+	const struct regexnet_shape *shape;
+	enum regexnet_class class = REGEXNET_CLASS_PUNCT;
+	unsigned int in_class = 0;
+	int c;
+
+	CHECK_HTTP_MESSAGE_FIRST();
+
+	if (args && args[0].type == ARGT_SINT)
+		class = args[0].data.sint;
+
+	shape = regexnet_get_shape(smp->strm, smp->strm->txn);
+	for (c = 0; c < 256; c++) {
+		if (shape->hist[c] && regexnet_in_class(c, class))
+			in_class += shape->hist[c];
+	}
+	smp->data.type = SMP_T_SINT;
+	smp->data.u.sint = shape->bytes ? (long long)in_class * 100 / shape->bytes : 0;
+	smp->flags = SMP_F_VOL_HDR;
+	return 1;
+}
+
+/* Checks that the optional argument of req.hdr_maxrun is a single character */
+static int
+val_hdr_maxrun(struct arg *arg, char **err_msg)
+{
+	if (arg[0].type == ARGT_STR && arg[0].data.str.len != 1) {
+		memprintf(err_msg, "a single character is expected, got '%s'", arg[0].data.str.str);
+		return 0;
+	}
+	return 1;
+}
+
+/* Turns the optional class name of req.hdr_charclass_ratio into its number */
+static int
+val_hdr_charclass(struct arg *arg, char **err_msg)
+{
+	int class;
+
+	if (arg[0].type != ARGT_STR)
+		return 1;
+	for (class = 0; class < REGEXNET_CLASS_END; class++) {
+		if (strcmp(arg[0].data.str.str, regexnet_class_names[class]) == 0)
+			break;
+	}
+	if (class == REGEXNET_CLASS_END) {
+		memprintf(err_msg, "unknown character class '%s', expects one of alpha, digit, alnum, punct, space, cntrl or high",
+			  arg[0].data.str.str);
+		return 0;
+	}
+	free(arg[0].data.str.str);
+	arg[0].type = ARGT_SINT;
+	arg[0].data.sint = class;
+	return 1;
+}
+
+/* Declare the filter parser for "regexnet-mirror" keyword */
+static struct flt_kw_list flt_kws = { "REGEXNET", { }, {
+		{ "regexnet-mirror", parse_regexnet_flt, NULL },
+		{ NULL, NULL, NULL },
+	}
+};
+
+/* Note: must not be declared <const> as its list will be overwritten */
+static struct sample_fetch_kw_list sample_fetch_keywords = {ILH, {
+		{ "req.hdr_maxlen",          smp_fetch_hdr_maxlen,          0,           NULL,              SMP_T_SINT, SMP_USE_HRQHV },
+		{ "req.hdr_maxrun",          smp_fetch_hdr_maxrun,          ARG1(0,STR), val_hdr_maxrun,    SMP_T_SINT, SMP_USE_HRQHV },
+		{ "req.hdr_charclass_ratio", smp_fetch_hdr_charclass_ratio, ARG1(0,STR), val_hdr_charclass, SMP_T_SINT, SMP_USE_HRQHV },
+		{ /* END */ },
+	}
+};
+
+static struct cli_kw_list cli_kws = {{ },{
+	{ { "show", "regexnet", NULL }, "show regexnet  : report the counters of the regexnet-mirror filters", cli_parse_show_regexnet, cli_io_handler_show_regexnet },
+	{{},}
+}};
+
+__attribute__((constructor))
+static void
+__flt_regexnet_init(void)
+{
+	flt_register_keywords(&flt_kws);
+	sample_register_fetches(&sample_fetch_keywords);
+	cli_register_kw(&cli_kws);
+}
@@ -0,0 +1,751 @@
+/*
+ * RegexNet classification filter: runs the detector's CNN on each request.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ *
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/stat.h>
+
+#include <common/buffer.h>
+#include <common/cfgparse.h>
+#include <common/standard.h>
+#include <common/time.h>
+#include <common/hathreads.h>
+
+#include <types/arg.h>
+#include <types/channel.h>
+#include <types/filters.h>
+#include <types/global.h>
+#include <types/proto_http.h>
+#include <types/proxy.h>
+#include <types/sample.h>
+#include <types/stream.h>
+
+#include <proto/filters.h>
+#include <proto/log.h>
+#include <proto/proto_http.h>
+#include <proto/sample.h>
+#include <proto/stream.h>
+#include <proto/vars.h>
+
+/* The model of classifier/model_cnn.py, evaluated on the header block of each
+ * request as soon as it is parsed, so that the verdict is in a variable for
+ * the http-request and use_backend rules. Weights come from the file written
+ * by classifier/export_weights.py.
+ *
+ * The embedding is folded into the convolution when the weights are loaded:
+ * table[letter][k][c] is the contribution of <letter> at offset k of a window
+ * to channel c. A window then costs <kernel> lookups of a contiguous row of
+ * floats to add. The rows are padded to whole blocks of REGEXNET_CNN_LANES
+ * and added block by block, a loop of constant length which the compiler
+ * vectorizes at the -O2 HAProxy is built with. Windows are
+ * pooled as they are computed, the pyramid bins of one level do not overlap,
+ * and at most max-bytes of the request are read: the cost of a request is
+ * bounded and nothing is allocated for it.
+ *
+ * A loader thread checks the file once per REGEXNET_CNN_RELOAD_MS and loads
+ * the weights when the data manager exported new ones, away from the event
+ * loops. The new model is published with an atomic pointer swap. A request
+ * announces the model it classifies with in its thread's slot, and a replaced
+ * model is freed by the loader once no slot holds it anymore. Until a file is
+ * there, requests are not classified and the variable stays unset.
+ */
+#define REGEXNET_CNN_MAGIC		"RXCNN001"
+#define REGEXNET_CNN_MAX_BYTES		2048		/* default bytes of request classified */
+#define REGEXNET_CNN_RELOAD_MS		1000
+#define REGEXNET_CNN_VAR		"txn.regexnet.cnn"
+#define REGEXNET_CNN_MAX_CHANNELS	64		/* a multiple of the lanes */
+#define REGEXNET_CNN_LANES		8
+#define REGEXNET_CNN_MAX_LEVELS		8
+#define REGEXNET_CNN_MAX_CLASSES	8
+#define REGEXNET_CNN_MAX_GRIDS		(REGEXNET_CNN_MAX_LEVELS * (REGEXNET_CNN_MAX_LEVELS + 1) / 2)
+#define REGEXNET_CNN_CACHELINE		64
+
+const char *regexnet_cnn_flt_id = "regexnet-classify filter";
+
+struct flt_ops regexnet_cnn_ops;
+
+/* Tells apart the versions of the weights file */
+struct regexnet_cnn_file {
+	dev_t  dev;
+	ino_t  ino;
+	time_t mtime;
+};
+
+struct regexnet_cnn_model {
+	struct regexnet_cnn_model *next;	/* replaced ones, loader only */
+	struct regexnet_cnn_file file;		/* it was loaded from */
+	unsigned int   vocab;
+	unsigned int   channels;
+	unsigned int   width;			/* channels, padded to whole lanes */
+	unsigned int   kernel;
+	unsigned int   stride;
+	unsigned int   levels;
+	unsigned int   classes;
+	unsigned int   features;		/* channels * grids */
+	unsigned char  index[256];		/* letter of each byte */
+	unsigned char  pad;			/* letter padding the request */
+	float         *table;			/* [vocab][kernel][width] */
+	float         *bias;			/* [width] */
+	float         *weight;			/* [classes][features] */
+	float         *weight_bias;		/* [classes] */
+};
+
+/* What a thread classifies with */
+struct regexnet_cnn_thread {
+	struct regexnet_cnn_model *model;	/* in use by a request, or NULL */
+} __attribute__((aligned(REGEXNET_CNN_CACHELINE)));
+
+struct regexnet_cnn_config {
+	struct proxy               *proxy;
+	char                       *name;
+	char                       *path;		/* of the weights */
+	char                       *var;		/* set to the verdict */
+	unsigned int                max_bytes;
+	struct regexnet_cnn_model  *model;		/* current one, shared */
+	struct regexnet_cnn_model  *retired;		/* replaced, maybe still in use */
+	struct regexnet_cnn_thread *threads;		/* one per thread */
+
+	/* the loader */
+	struct regexnet_cnn_file    seen;		/* last file tried, loaded or not */
+	int                         stopping;
+	int                         started;
+	pthread_t                   thread;
+	pthread_mutex_t             lock;
+	pthread_cond_t              cond;
+};
+
+/***************************************************************************
+ * Weights
+ **************************************************************************/
+static void
+regexnet_cnn_free_model(struct regexnet_cnn_model *model)
+{
+	if (!model)
+		return;
+	free(model->table);
+	free(model->bias);
+	free(model->weight);
+	free(model->weight_bias);
+	free(model);
+}
+
+/* Reads <count> little endian floats from <f> into <out> */
+static int
+regexnet_cnn_read_floats(FILE *f, float *out, size_t count)
+{
+	size_t i;
+
+	if (fread(out, sizeof(*out), count, f) != count)
+		return 0;
+	for (i = 0; i < count; i++) {
+		unsigned int v;
+
+		memcpy(&v, &out[i], sizeof(v));
+		v = le32toh(v);
+		memcpy(&out[i], &v, sizeof(v));
+	}
+	return 1;
+}
+
+/* Loads the weights in <path> and folds the embedding into the convolution.
+ * Returns NULL and fills <err> on error.
+ */
+static struct regexnet_cnn_model *
+regexnet_cnn_load(const char *path, char **err)
+{
+	struct regexnet_cnn_model *model = NULL;
+	unsigned int dims[7], embedding, grids, i, c, e, k;
+	float *emb = NULL, *conv = NULL;
+	char magic[sizeof(REGEXNET_CNN_MAGIC) - 1];
+	unsigned char alphabet[256];
+	struct stat st;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f || fstat(fileno(f), &st) != 0) {
+		memprintf(err, "cannot open '%s': %s", path, strerror(errno));
+		goto error;
+	}
+	if (fread(magic, sizeof(magic), 1, f) != 1 ||
+	    memcmp(magic, REGEXNET_CNN_MAGIC, sizeof(magic)) != 0 ||
+	    fread(dims, sizeof(dims), 1, f) != 1) {
+		memprintf(err, "'%s' is not a weights file of export_weights.py", path);
+		goto error;
+	}
+	model = calloc(1, sizeof(*model));
+	if (!model) {
+		memprintf(err, "out of memory");
+		goto error;
+	}
+	model->file.dev   = st.st_dev;
+	model->file.ino   = st.st_ino;
+	model->file.mtime = st.st_mtime;
+	model->vocab    = le32toh(dims[0]);
+	embedding       = le32toh(dims[1]);
+	model->channels = le32toh(dims[2]);
+	model->kernel   = le32toh(dims[3]);
+	model->stride   = le32toh(dims[4]);
+	model->levels   = le32toh(dims[5]);
+	model->classes  = le32toh(dims[6]);
+	grids = model->levels * (model->levels + 1) / 2;
+	model->features = model->channels * grids;
+	model->width    = (model->channels + REGEXNET_CNN_LANES - 1) / REGEXNET_CNN_LANES * REGEXNET_CNN_LANES;
+
+	if (model->vocab < 1 || model->vocab > 256 || embedding < 1 || embedding > 1024 ||
+	    model->channels < 1 || model->channels > REGEXNET_CNN_MAX_CHANNELS ||
+	    model->kernel < 1 || model->kernel > 4096 || model->stride < 1 || model->stride > model->kernel ||
+	    model->levels < 1 || model->levels > REGEXNET_CNN_MAX_LEVELS ||
+	    model->classes < 2 || model->classes > REGEXNET_CNN_MAX_CLASSES) {
+		memprintf(err, "'%s' has unsupported dimensions", path);
+		goto error;
+	}
+
+	/* unknown bytes are the last letter, '\0', as in detector.py */
+	if (fread(alphabet, model->vocab, 1, f) != 1) {
+		memprintf(err, "'%s' is truncated", path);
+		goto error;
+	}
+	memset(model->index, model->vocab - 1, sizeof(model->index));
+	for (i = model->vocab; i-- > 0; )
+		model->index[alphabet[i]] = i;
+	model->pad = model->index[0];
+
+	emb                = malloc(sizeof(float) * model->vocab * embedding);
+	conv               = malloc(sizeof(float) * model->channels * embedding * model->kernel);
+	model->table       = calloc(model->vocab * model->kernel * model->width, sizeof(float));
+	model->bias        = calloc(model->width, sizeof(float));
+	model->weight      = malloc(sizeof(float) * model->classes * model->features);
+	model->weight_bias = malloc(sizeof(float) * model->classes);
+	if (!emb || !conv || !model->table || !model->bias || !model->weight || !model->weight_bias) {
+		memprintf(err, "out of memory");
+		goto error;
+	}
+	if (!regexnet_cnn_read_floats(f, emb, model->vocab * embedding) ||
+	    !regexnet_cnn_read_floats(f, conv, model->channels * embedding * model->kernel) ||
+	    !regexnet_cnn_read_floats(f, model->bias, model->channels) ||
+	    !regexnet_cnn_read_floats(f, model->weight, model->classes * model->features) ||
+	    !regexnet_cnn_read_floats(f, model->weight_bias, model->classes)) {
+		memprintf(err, "'%s' is truncated", path);
+		goto error;
+	}
+
+	for (i = 0; i < model->vocab; i++) {
+		for (k = 0; k < model->kernel; k++) {
+			float *row = model->table + (i * model->kernel + k) * model->width;
+
+			for (c = 0; c < model->channels; c++) {
+				for (e = 0; e < embedding; e++)
+					row[c] += conv[(c * embedding + e) * model->kernel + k] * emb[i * embedding + e];
+			}
+		}
+	}
+	free(emb);
+	free(conv);
+	fclose(f);
+	return model;
+
+ error:
+	free(emb);
+	free(conv);
+	regexnet_cnn_free_model(model);
+	if (f)
+		fclose(f);
+	return NULL;
+}
+
+/* Frees the replaced models which no thread classifies with anymore */
+static void
+regexnet_cnn_reclaim(struct regexnet_cnn_config *conf)
+{
+	struct regexnet_cnn_model **prev = &conf->retired, *model;
+	int i;
+
+	while ((model = *prev)) {
+		for (i = 0; i < global.nbthread; i++) {
+			if (__atomic_load_n(&conf->threads[i].model, __ATOMIC_SEQ_CST) == model)
+				break;
+		}
+		if (i < global.nbthread) {
+			prev = &model->next;
+			continue;
+		}
+		*prev = model->next;
+		regexnet_cnn_free_model(model);
+	}
+}
+
+/* Loads the weights again if the file was replaced, and publishes them. A
+ * file which cannot be loaded is tried only once. Loader only.
+ */
+static void
+regexnet_cnn_refresh(struct regexnet_cnn_config *conf)
+{
+	struct regexnet_cnn_model *model;
+	struct stat st;
+	char *err = NULL;
+
+	if (stat(conf->path, &st) != 0)
+		return;
+	if (conf->seen.dev == st.st_dev && conf->seen.ino == st.st_ino && conf->seen.mtime == st.st_mtime)
+		return;
+	conf->seen.dev   = st.st_dev;
+	conf->seen.ino   = st.st_ino;
+	conf->seen.mtime = st.st_mtime;
+
+	model = regexnet_cnn_load(conf->path, &err);
+	if (!model) {
+		tv_update_date(-1, -1);
+		ha_warning("%s: cannot reload the weights: %s\n", conf->name, err);
+		free(err);
+		return;
+	}
+	model = __atomic_exchange_n(&conf->model, model, __ATOMIC_SEQ_CST);
+	if (model) {
+		model->next = conf->retired;
+		conf->retired = model;
+	}
+}
+
+static void *
+regexnet_cnn_loader(void *arg)
+{
+	struct regexnet_cnn_config *conf = arg;
+	struct timespec deadline;
+
+	pthread_mutex_lock(&conf->lock);
+	while (!conf->stopping) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec  += REGEXNET_CNN_RELOAD_MS / 1000;
+		deadline.tv_nsec += (REGEXNET_CNN_RELOAD_MS % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec += 1;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&conf->cond, &conf->lock, &deadline);
+		if (conf->stopping)
+			break;
+		pthread_mutex_unlock(&conf->lock);
+
+		regexnet_cnn_reclaim(conf);
+		regexnet_cnn_refresh(conf);
+
+		pthread_mutex_lock(&conf->lock);
+	}
+	pthread_mutex_unlock(&conf->lock);
+	return NULL;
+}
+
+static void
+regexnet_cnn_stop(struct regexnet_cnn_config *conf)
+{
+	if (!conf->started)
+		return;
+	pthread_mutex_lock(&conf->lock);
+	conf->stopping = 1;
+	pthread_cond_signal(&conf->cond);
+	pthread_mutex_unlock(&conf->lock);
+	pthread_join(conf->thread, NULL);
+	conf->started = 0;
+}
+
+/* Returns the current model, announced in the slot of the calling thread
+ * until regexnet_cnn_release(), or NULL if there is none. The slot is set
+ * before the model is read again: once the loader swapped it out, either it
+ * sees the slot or the request sees the new model.
+ */
+static struct regexnet_cnn_model *
+regexnet_cnn_hold(struct regexnet_cnn_config *conf, struct regexnet_cnn_thread *th)
+{
+	struct regexnet_cnn_model *model;
+
+	do {
+		model = __atomic_load_n(&conf->model, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&th->model, model, __ATOMIC_SEQ_CST);
+	} while (model != __atomic_load_n(&conf->model, __ATOMIC_SEQ_CST));
+	return model;
+}
+
+static inline void
+regexnet_cnn_release(struct regexnet_cnn_thread *th)
+{
+	__atomic_store_n(&th->model, NULL, __ATOMIC_RELEASE);
+}
+
+/***************************************************************************
+ * Inference
+ **************************************************************************/
+/* Returns the class of the <len> bytes at <data>, of which at most <max_bytes>
+ * are read. The text is padded to a whole number of strides, and to at least
+ * one window, with the letter '\0' like data.lineToTensor() does.
+ */
+static unsigned int
+regexnet_cnn_classify(const struct regexnet_cnn_model *model, const char *data,
+		      unsigned int len, unsigned int max_bytes)
+{
+	float acc[REGEXNET_CNN_MAX_CHANNELS];
+	float pool[REGEXNET_CNN_MAX_CHANNELS * REGEXNET_CNN_MAX_GRIDS];
+	unsigned int size[REGEXNET_CNN_MAX_LEVELS], pad[REGEXNET_CNN_MAX_LEVELS];
+	unsigned int padded, windows, level, offset, best;
+	unsigned int i, j, k, c, l;
+	float score, best_score;
+
+	if (len > max_bytes)
+		len = max_bytes;
+	padded = (len + model->stride - 1) / model->stride * model->stride;
+	if (padded < model->kernel)
+		padded = model->kernel;
+	windows = (padded - model->kernel) / model->stride + 1;
+
+	/* bins of the pyramid levels, as spp.SPPLayer cuts them */
+	for (level = 0; level < model->levels; level++) {
+		size[level] = (windows + level) / (level + 1);
+		pad[level]  = (size[level] * (level + 1) - windows + 1) / 2;
+	}
+	/* tanh() is monotonic: bins keep the max before it, and an empty one
+	 * ends up at -1 like max_pool1d's padding
+	 */
+	for (i = 0; i < model->features; i++)
+		pool[i] = -INFINITY;
+
+	for (j = 0; j < windows; j++) {
+		const unsigned int start = j * model->stride;
+
+		memcpy(acc, model->bias, sizeof(*acc) * model->width);
+		for (k = 0; k < model->kernel; k++) {
+			unsigned char letter = start + k < len ? model->index[(unsigned char)data[start + k]] : model->pad;
+			const float *row = model->table + (letter * model->kernel + k) * model->width;
+
+			for (c = 0; c < model->width; c += REGEXNET_CNN_LANES) {
+				float *a = acc + c;
+				const float *r = row + c;
+
+				for (l = 0; l < REGEXNET_CNN_LANES; l++)
+					a[l] += r[l];
+			}
+		}
+
+		offset = 0;
+		for (level = 0; level < model->levels; level++) {
+			unsigned int bin = (j + pad[level]) / size[level];
+
+			if (bin <= level) {
+				for (c = 0; c < model->channels; c++) {
+					float *p = &pool[offset + c * (level + 1) + bin];
+
+					if (acc[c] > *p)
+						*p = acc[c];
+				}
+			}
+			offset += model->channels * (level + 1);
+		}
+	}
+	for (i = 0; i < model->features; i++)
+		pool[i] = tanhf(pool[i]);
+
+	/* log-softmax keeps the order of the scores */
+	best = 0;
+	best_score = -INFINITY;
+	for (k = 0; k < model->classes; k++) {
+		const float *w = model->weight + k * model->features;
+
+		score = model->weight_bias[k];
+		for (i = 0; i < model->features; i++)
+			score += w[i] * pool[i];
+		if (score > best_score) {
+			best = k;
+			best_score = score;
+		}
+	}
+	return best;
+}
+
+/***************************************************************************
+ * Hooks that manage the filter lifecycle (init/check/deinit)
+ **************************************************************************/
+/* Initialize the filter. Returns -1 on error, else 0. */
+static int
+regexnet_cnn_init(struct proxy *px, struct flt_conf *fconf)
+{
+	struct regexnet_cnn_config *conf = fconf->conf;
+	char *err = NULL;
+
+	if (conf->name)
+		memprintf(&conf->name, "%s/%s", conf->name, px->id);
+	else
+		memprintf(&conf->name, "REGEXNET-CNN/%s", px->id);
+
+	if (posix_memalign((void **)&conf->threads, REGEXNET_CNN_CACHELINE,
+			   global.nbthread * sizeof(*conf->threads)) != 0) {
+		conf->threads = NULL;
+		ha_alert("config: %s '%s': out of memory\n",
+			 proxy_type_str(px), px->id);
+		return -1;
+	}
+	memset(conf->threads, 0, global.nbthread * sizeof(*conf->threads));
+
+	/* the data manager may well export them later */
+	conf->model = regexnet_cnn_load(conf->path, &err);
+	if (!conf->model) {
+		ha_warning("config: %s '%s': regexnet-classify: %s, requests are not classified until it is there\n",
+			   proxy_type_str(px), px->id, err);
+		free(err);
+	}
+	else
+		conf->seen = conf->model->file;
+	fconf->conf = conf;
+	return 0;
+}
+
+/* Free ressources allocated by the filter, once its loader is stopped. */
+static void
+regexnet_cnn_deinit(struct proxy *px, struct flt_conf *fconf)
+{
+	struct regexnet_cnn_config *conf = fconf->conf;
+	struct regexnet_cnn_model *model;
+
+	if (conf) {
+		regexnet_cnn_stop(conf);
+		pthread_mutex_destroy(&conf->lock);
+		pthread_cond_destroy(&conf->cond);
+		while ((model = conf->retired)) {
+			conf->retired = model->next;
+			regexnet_cnn_free_model(model);
+		}
+		regexnet_cnn_free_model(conf->model);
+		free(conf->threads);
+		free(conf->path);
+		free(conf->var);
+		free(conf->name);
+		free(conf);
+	}
+	fconf->conf = NULL;
+}
+
+/* Check configuration of the filter for a specified proxy.
+ * Return 1 on error, else 0. */
+static int
+regexnet_cnn_check(struct proxy *px, struct flt_conf *fconf)
+{
+	if (px->mode != PR_MODE_HTTP) {
+		ha_alert("config: %s '%s': regexnet-classify filter requires HTTP mode\n",
+			 proxy_type_str(px), px->id);
+		return 1;
+	}
+	return 0;
+}
+
+/* Starts the loader from the first thread, once the process is forked and
+ * before any request is processed. Return -1 on error, else 0. */
+static int
+regexnet_cnn_init_per_thread(struct proxy *px, struct flt_conf *fconf)
+{
+	struct regexnet_cnn_config *conf = fconf->conf;
+
+	if (tid != 0)
+		return 0;
+	if (pthread_create(&conf->thread, NULL, regexnet_cnn_loader, conf) != 0) {
+		ha_alert("%s: cannot start the weights loader\n", conf->name);
+		return -1;
+	}
+	conf->started = 1;
+	return 0;
+}
+
+/**************************************************************************
+ * Hooks to handle channels activity
+ *************************************************************************/
+/* Called when analyze starts for a given channel. The request is classified
+ * as soon as its headers are parsed, before any rule. */
+static int
+regexnet_cnn_chn_start_analyze(struct stream *s, struct filter *filter,
+			       struct channel *chn)
+{
+	if (!(chn->flags & CF_ISRESP))
+		filter->post_analyzers |= AN_REQ_WAIT_HTTP;
+	return 1;
+}
+
+/* Called after a processing happens on a given channel */
+static int
+regexnet_cnn_chn_post_analyze(struct stream *s, struct filter *filter,
+			      struct channel *chn, unsigned an_bit)
+{
+	struct regexnet_cnn_config *conf = FLT_CONF(filter);
+	struct regexnet_cnn_thread *th = &conf->threads[tid];
+	struct regexnet_cnn_model *model;
+	struct http_msg *msg;
+	struct sample smp;
+	int rewind;
+
+	if (an_bit != AN_REQ_WAIT_HTTP || !s->txn)
+		return 1;
+
+	model = regexnet_cnn_hold(conf, th);
+	if (!model)
+		return 1;
+
+	msg = &s->txn->req;
+	rewind = http_hdr_rewind(msg);
+
+	memset(&smp, 0, sizeof(smp));
+	smp_set_owner(&smp, s->be, s->sess, s, SMP_OPT_DIR_REQ|SMP_OPT_FINAL);
+	smp.data.type = SMP_T_BOOL;
+	smp.data.u.sint = regexnet_cnn_classify(model, b_ptr(msg->chn->buf, -rewind),
+						msg->eoh + msg->eol, conf->max_bytes) == 1;
+	regexnet_cnn_release(th);
+	vars_set_by_name_ifexist(conf->var, strlen(conf->var), &smp);
+	return 1;
+}
+
+/********************************************************************
+ * Functions that manage the filter initialization
+ ********************************************************************/
+struct flt_ops regexnet_cnn_ops = {
+	/* Manage the filter, called for each filter declaration */
+	.init              = regexnet_cnn_init,
+	.deinit            = regexnet_cnn_deinit,
+	.check             = regexnet_cnn_check,
+	.init_per_thread   = regexnet_cnn_init_per_thread,
+
+	/* Handle channels activity */
+	.channel_start_analyze = regexnet_cnn_chn_start_analyze,
+	.channel_post_analyze  = regexnet_cnn_chn_post_analyze,
+};
+
+/* Parses "filter regexnet-classify [name <name>] weights <path> [var <name>]
+ *   [max-bytes <size>]"
+ * Return -1 on error, else 0 */
+static int
+parse_regexnet_cnn_flt(char **args, int *cur_arg, struct proxy *px,
+		       struct flt_conf *fconf, char **err, void *private)
+{
+	struct regexnet_cnn_config *conf;
+	struct arg                  var[2];
+	const char                 *res;
+	int                         pos = *cur_arg + 1;
+
+	conf = calloc(1, sizeof(*conf));
+	if (!conf) {
+		memprintf(err, "%s: out of memory", args[*cur_arg]);
+		return -1;
+	}
+	conf->proxy     = px;
+	conf->max_bytes = REGEXNET_CNN_MAX_BYTES;
+	pthread_mutex_init(&conf->lock, NULL);
+	pthread_cond_init(&conf->cond, NULL);
+
+	while (*args[pos]) {
+		if (!strcmp(args[pos], "name") || !strcmp(args[pos], "weights") ||
+		    !strcmp(args[pos], "var") || !strcmp(args[pos], "max-bytes")) {
+			if (!*args[pos + 1]) {
+				memprintf(err, "'%s' : '%s' option without value",
+					  args[*cur_arg], args[pos]);
+				goto error;
+			}
+		}
+		else
+			break;
+
+		if (!strcmp(args[pos], "name")) {
+			free(conf->name);
+			conf->name = strdup(args[pos + 1]);
+			if (!conf->name) {
+				memprintf(err, "%s: out of memory", args[*cur_arg]);
+				goto error;
+			}
+		}
+		else if (!strcmp(args[pos], "weights")) {
+			free(conf->path);
+			conf->path = strdup(args[pos + 1]);
+			if (!conf->path) {
+				memprintf(err, "%s: out of memory", args[*cur_arg]);
+				goto error;
+			}
+		}
+		else if (!strcmp(args[pos], "var")) {
+			free(conf->var);
+			conf->var = strdup(args[pos + 1]);
+			if (!conf->var) {
+				memprintf(err, "%s: out of memory", args[*cur_arg]);
+				goto error;
+			}
+		}
+		else if (!strcmp(args[pos], "max-bytes")) {
+			res = parse_size_err(args[pos + 1], &conf->max_bytes);
+			if (res) {
+				memprintf(err, "'%s' : unexpected character '%c' in '%s' argument",
+					  args[*cur_arg], *res, args[pos]);
+				goto error;
+			}
+			if (!conf->max_bytes) {
+				memprintf(err, "'%s' : '%s' must be positive",
+					  args[*cur_arg], args[pos]);
+				goto error;
+			}
+		}
+		pos += 2;
+	}
+
+	if (!conf->path) {
+		memprintf(err, "'%s' : the 'weights' file is required", args[*cur_arg]);
+		goto error;
+	}
+	if (!conf->var && (conf->var = strdup(REGEXNET_CNN_VAR)) == NULL) {
+		memprintf(err, "%s: out of memory", args[*cur_arg]);
+		goto error;
+	}
+
+	/* registered now, so that it is only looked up per request */
+	var[0].type = ARGT_STR;
+	var[0].data.str.str = conf->var;
+	var[0].data.str.len = strlen(conf->var);
+	var[1].type = ARGT_STOP;
+	if (!vars_check_arg(var, err)) {
+		memprintf(err, "'%s' : invalid variable '%s' : %s",
+			  args[*cur_arg], conf->var, *err);
+		goto error;
+	}
+
+	*cur_arg    = pos;
+	fconf->id   = regexnet_cnn_flt_id;
+	fconf->ops  = &regexnet_cnn_ops;
+	fconf->conf = conf;
+	return 0;
+
+ error:
+	pthread_mutex_destroy(&conf->lock);
+	pthread_cond_destroy(&conf->cond);
+	free(conf->path);
+	free(conf->var);
+	free(conf->name);
+	free(conf);
+	return -1;
+}
+
+/* Declare the filter parser for "regexnet-classify" keyword */
+static struct flt_kw_list flt_kws = { "REGEXNET-CNN", { }, {
+		{ "regexnet-classify", parse_regexnet_cnn_flt, NULL },
+		{ NULL, NULL, NULL },
+	}
+};
+
+__attribute__((constructor))
+static void
+__flt_regexnet_cnn_init(void)
+{
+	flt_register_keywords(&flt_kws);
+}
@@ -118,8 +118,6 @@
 #include <proto/ssl_sock.h>
 #endif
 
-#include "customize.h"
-
 /* list of config files */
 static struct list cfg_cfgfiles = LIST_HEAD_INIT(cfg_cfgfiles);
 int  pid;			/* current process id */
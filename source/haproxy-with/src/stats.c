@@ -48,6 +48,7 @@
 #include <proto/checks.h>
 #include <proto/cli.h>
 #include <proto/compression.h>
+#include <proto/flt_regexnet.h>
 #include <proto/stats.h>
 #include <proto/fd.h>
 #include <proto/freq_ctr.h>
@@ -133,6 +134,12 @@ const char *info_field_names[INF_TOTAL_FIELDS] = {
 	[INF_STOPPING]                       = "Stopping",
 	[INF_JOBS]                           = "Jobs",
 	[INF_LISTENERS]                      = "Listeners",
+	[INF_REGEXNET_MIRRORED]              = "RegexnetMirrored",
+	[INF_REGEXNET_MIRROR_RATE]           = "RegexnetMirrorRate",
+	[INF_REGEXNET_MIRROR_BPS]            = "RegexnetMirrorBps",
+	[INF_REGEXNET_DROPPED]               = "RegexnetDropped",
+	[INF_REGEXNET_DROP_RATE]             = "RegexnetDropRate",
+	[INF_REGEXNET_QUEUED]                = "RegexnetQueued",
 };
 
 const char *stat_field_names[ST_F_TOTAL_FIELDS] = {
@@ -219,6 +226,11 @@ const char *stat_field_names[ST_F_TOTAL_FIELDS] = {
 	[ST_F_INTERCEPTED]    = "intercepted",
 	[ST_F_DCON]           = "dcon",
 	[ST_F_DSES]           = "dses",
+	[ST_F_MIRROR_REQ]     = "mirror_req",
+	[ST_F_MIRROR_RATE]    = "mirror_rate",
+	[ST_F_MIRROR_BYTES]   = "mirror_bytes",
+	[ST_F_MIRROR_DROP]    = "mirror_drop",
+	[ST_F_MIRROR_QCUR]    = "mirror_qcur",
 };
 
 /* one line of info */
@@ -1329,6 +1341,9 @@ int stats_fill_fe_stats(struct proxy *px, struct field *stats, int len)
 	stats[ST_F_CONN_RATE_MAX] = mkf_u32(FN_MAX, px->fe_counters.cps_max);
 	stats[ST_F_CONN_TOT]      = mkf_u64(FN_COUNTER, px->fe_counters.cum_conn);
 
+	/* requests mirrored to the detectors, if any */
+	regexnet_fill_stats(px, stats);
+
 	return 1;
 }
 
@@ -1797,6 +1812,10 @@ int stats_fill_be_stats(struct proxy *px, int flags, struct field *stats, int le
 	stats[ST_F_RTIME]        = mkf_u32(FN_AVG, swrate_avg(px->be_counters.d_time, TIME_STATS_SAMPLES));
 	stats[ST_F_TTIME]        = mkf_u32(FN_AVG, swrate_avg(px->be_counters.t_time, TIME_STATS_SAMPLES));
 
+	/* a listen section reports them on its frontend */
+	if (!(px->cap & PR_CAP_FE))
+		regexnet_fill_stats(px, stats);
+
 	return 1;
 }
 
@@ -3278,6 +3297,7 @@ int stats_fill_info(struct field *info, int len)
 	info[INF_STOPPING]                       = mkf_u32(0, stopping);
 	info[INF_JOBS]                           = mkf_u32(0, jobs);
 	info[INF_LISTENERS]                      = mkf_u32(0, listeners);
+	regexnet_fill_info(info);
 
 	return 1;
 }
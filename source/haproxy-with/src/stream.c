@@ -14,8 +14,6 @@
 #include <unistd.h>
 #include <fcntl.h>
 
-#include <customize.h>
-
 #include <common/cfgparse.h>
 #include <common/config.h>
 #include <common/buffer.h>
@@ -2327,10 +2325,6 @@ struct task *process_stream(struct task *t)
 	/*
 	 * Now forward all shutdown requests between both sides of the buffer
 	 */
-	if (req->buf->o > 0) {
-		customize_copy_to_detector(s->txn->req, s->uniq_id);
-	}
-
 	/*
 	 * FIXME: this is probably where we should produce error responses.
 	 */
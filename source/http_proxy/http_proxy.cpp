@@ -8,19 +8,33 @@
 #include <sys/types.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <inttypes.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
 
+#include <atomic>
 #include <chrono>
 #include <deque>
 #include <set>
 #include <map>
+#include <vector>
 #include <iterator>
 #include <iostream>
+#include <algorithm>
+#include <random>
+#include <thread>
 
 #include "util/tool.h"
 #include "util/udp_tool.h"
 #include "util/tcp_tool.h"
 #include "util/http_tool.h"
+#include "util/proc_tool.h"
+#include "util/measure.h"
+#include "util/file_cache.h"
+#include "util/compress_tool.h"
 
 #define MAX_LENGTH 100000
 
@@ -35,12 +49,86 @@
 
 const char *ADDR_COLLECTOR = "127.0.0.1"; // localhost
 #define PORT_COLLECTOR  9003
+#define REPORT_COMPRESS_MIN 8192    // Reports at least this long are compressed, 0 for never
 
 const char *ADDR_SANDBOX = "127.0.0.1"; // localhost
-#define PORT_SANDBOX    8099
+#define PORT_SANDBOX    8099 // Sandbox i listens on PORT_SANDBOX + i
+
+#define NUM_SANDBOX                 2
+#define SANDBOX_QUEUE_LIMIT         64      // Flagged requests waiting for a sandbox, over all sources
+#define SANDBOX_SOURCE_LIMIT        8       // Flagged requests waiting for a sandbox, per source
+#define SANDBOX_CPU_DEADLINE_US     1000000 // CPU time a sandbox may spend on one request
+#define SANDBOX_WALL_DEADLINE_US    5000000 // Wall time a sandbox may spend on one request
+#define SANDBOX_RESTART_US          1000000 // Time for a restarted sandbox to listen again
+#define SANDBOX_SWEEP_US            10000   // Interval between two deadline checks
+
+#define RESTART_NONE    0   // Keep serving from a stalled worker
+#define RESTART_SWITCH  1   // Move the pool to its next worker
+#define RESTART_KILL    2   // Move the pool to its next worker and restart the stalled one
+
+// Bulkheads: every pool has its own node.js workers, so a request stalling one
+// pool leaves the others serving at full speed
+struct pool_config_t {
+    const char *name;
+    int first_port;         // Worker i listens on first_port + i
+    int num_workers;
+    int concurrency_limit;  // Requests forwarded to the pool at the same time
+    int restart_policy;
+    int64_t stall_us;       // Recycle the active worker once a request waits this long; 0 waits for a warning
+};
+
+// Pool 0 takes every request that matches no route
+const pool_config_t POOLS[] = {
+    {"main",        PORT_NODEJS_A,  NUM_NODEJS, 64, RESTART_SWITCH, 0},
+    {"vulnerable",  8885,           2,          4,  RESTART_KILL,   2000000}
+};
+#define NUM_POOLS       (int)(sizeof(POOLS) / sizeof(POOLS[0]))
+#define POOL_SWEEP_US   10000   // Interval between two checks for stalled requests
+
+// The first rule matching both its URL prefix and its header (NULL matches anything) wins
+struct route_rule_t {
+    const char *prefix;
+    const char *header;
+    int pool;
+};
+
+// Headers parsed by the ReDoS-vulnerable modules of app.js
+const route_rule_t ROUTES[] = {
+    {NULL, "If-None-Match", 1},     // fresh, used by express itself
+    {NULL, "ms", 1},
+    {NULL, "moment", 1},
+    {NULL, "marked", 1},
+    {NULL, "ua-parser-js", 1},
+    {NULL, "tough-cookie", 1},
+    {NULL, "uglify-js", 1}
+};
+
+// Static files answered by the proxy itself, as express.static() would from these roots
+const char *STATIC_ROOTS[] = {
+    "/home/ubuntu/regexnet/build/application/public",
+    "/home/ubuntu/regexnet/build/application/views/themes"
+};
+const char *STATIC_PREFIXES[] = {
+    "/images/", "/javascripts/", "/stylesheets/", "/uploads/",
+    "/Cloth/", "/Material/", "/Mono/",
+    "/favicon.ico", "/favicon.png", "/robots.txt"
+};
+#define STATIC_MAX_ENTRIES      4096
+#define STATIC_INLINE_LIMIT     65536   // Larger files are sent with sendfile instead of from memory
+#define STATIC_REVALIDATE_US    1000000 // Interval between two stat() of a cached file
+
+#define HEDGE_BUDGET_PERCENT    5       // Share of GET/HEAD requests that may be duplicated
+#define HEDGE_BURST             10      // Hedges that may be spent at once after a quiet period
+#define HEDGE_QUANTILE          0.99    // Wait for this latency quantile of the route before hedging
+#define HEDGE_MIN_DELAY_US      10000   // Lower bound of the hedging threshold
+#define HEDGE_DEFAULT_DELAY_US  500000  // Threshold of a route with too few samples
+#define HEDGE_MIN_SAMPLES       32
+#define HEDGE_WINDOW            256     // Latency samples kept per route
+#define HEDGE_MAX_ROUTES        256     // Further routes share one set of samples
 
 #define MESSAGE_REQUEST 0
 #define MESSAGE_RESPONSE 1
+#define MESSAGE_COMPRESSED 0x100    // Flag on the type: the payload is deflate_datagram()'d
 
 using namespace std;
 
@@ -91,6 +179,12 @@ public:
     backend_t(int server_addr_, int server_port_):
         server_addr(server_addr_), server_port(server_port_) {}
 
+    virtual void restart() {}
+
+    virtual int get_pid() {
+        return -1;
+    }
+
     int request_connection() {
         return tcp_client_t::request_connection(server_addr, server_port);
     }
@@ -99,8 +193,12 @@ public:
         return tcp_send(conn, req->buffer, req->length);
     }
 
+    // Returns 0 while the response is pending and -1 once the server closed the connection
     int recv_response(int conn, message_t *res, int id) {
         res->length = read(conn, res->buffer, MAX_LENGTH);
+        if (res->length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
         if (res->length < 1) {
             return -1;
         }
@@ -145,14 +243,31 @@ public:
             fflush(stdout);
         }
     }
+
+    int get_pid() {
+        return pid;
+    }
 };
 
 class reporter_t: public udp_client_t {
+private:
+    message_t packed;
+
 public:
     reporter_t(int report_addr, int report_port): udp_client_t(report_addr, report_port) {}
 
     int send_report(message_t* msg) {
         unsigned int offset = (char*)(&(msg->buffer[0])) - (char*)(&(msg->type));
+        // Long reports are mostly attack padding; send them compressed if that at least halves them
+        if (REPORT_COMPRESS_MIN > 0 && msg->length >= REPORT_COMPRESS_MIN) {
+            int length = deflate_datagram(msg->buffer, msg->length, packed.buffer, msg->length / 2);
+            if (length >= 0) {
+                packed.type = msg->type | MESSAGE_COMPRESSED;
+                packed.id = msg->id;
+                packed.timestamp = msg->timestamp;
+                return udp_send((char*)&(packed.type), length + offset);
+            }
+        }
         int length = udp_send((char*)&(msg->type), msg->length + offset);
         return length;
     }
@@ -191,12 +306,26 @@ public:
 
 struct task_t {
     int stage; // accept conn -> 0 -> recv req -> 1 -> forward to backend -> 2 -> recv response -> forward to client -> 3
+               //                             -> 4 -> send static file -> 3
     int id;
+    int source;
     backend_t *backend;
     int frontend_conn;
     message_t *req;
     int backend_conn;
     message_t *res;
+
+    int res_sent;
+    shared_ptr<cached_file_t> file;
+    off_t file_offset;
+
+    int pool;
+    bool suspect; // Stalled its pool or flagged by the load balancer; goes to a sandbox
+    rolling_quantile_t *route; // NULL if the request is not idempotent
+    int64_t dispatch_time;
+    bool hedged;
+    backend_t *hedge_backend;
+    int hedge_conn;
 };
 
 deque<task_t> task_q;
@@ -208,6 +337,359 @@ int64_t get_time_us() {
     ).count();
 }
 
+file_cache_t static_cache(STATIC_ROOTS, sizeof(STATIC_ROOTS) / sizeof(STATIC_ROOTS[0]),
+    STATIC_MAX_ENTRIES, STATIC_INLINE_LIMIT, STATIC_REVALIDATE_US);
+
+// Answer whitelisted static files without waiting for a worker. On success the
+// response header is in task.res and task.file holds the body still to be sent.
+bool serve_static(task_t &task, int64_t now) {
+    char method[16], path[1024];
+    if (!http_get_request_line(task.req->buffer, method, sizeof(method), path, sizeof(path)))
+        return false;
+    bool head = strcmp(method, "HEAD") == 0;
+    if (!head && strcmp(method, "GET") != 0)
+        return false;
+
+    bool whitelisted = false;
+    for (size_t i = 0; i < sizeof(STATIC_PREFIXES) / sizeof(STATIC_PREFIXES[0]); ++i) {
+        if (strncmp(path, STATIC_PREFIXES[i], strlen(STATIC_PREFIXES[i])) == 0) {
+            whitelisted = true;
+            break;
+        }
+    }
+    if (!whitelisted)
+        return false;
+
+    shared_ptr<cached_file_t> file = static_cache.lookup(path, now);
+    if (!file)
+        return false;
+
+    // If-None-Match takes precedence over If-Modified-Since
+    bool not_modified = false;
+    char value[256];
+    if (http_get_header(task.req->buffer, "If-None-Match", value, sizeof(value)) >= 0) {
+        not_modified = strcmp(value, "*") == 0 || strstr(value, file->etag) != NULL ||
+            strstr(value, file->etag + 2) != NULL;
+    }
+    else if (http_get_header(task.req->buffer, "If-Modified-Since", value, sizeof(value)) >= 0) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        if (strptime(value, "%a, %d %b %Y %H:%M:%S GMT", &tm) != NULL)
+            not_modified = file->mtime <= timegm(&tm);
+    }
+
+    if (not_modified) {
+        task.res->length = sprintf(task.res->buffer,
+            "HTTP/1.1 304 Not Modified\r\nETag: %s\r\nLast-Modified: %s\r\n"
+            "Cache-Control: public, max-age=0\r\nConnection: close\r\n\r\n",
+            file->etag, file->last_modified);
+    }
+    else {
+        task.res->length = sprintf(task.res->buffer,
+            "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %lld\r\nETag: %s\r\n"
+            "Last-Modified: %s\r\nCache-Control: public, max-age=0\r\nAccept-Ranges: none\r\n"
+            "Connection: close\r\n\r\n",
+            file->mime, (long long)file->size, file->etag, file->last_modified);
+        if (!head)
+            task.file = file;
+    }
+    task.res_sent = 0;
+    task.file_offset = 0;
+    return true;
+}
+
+// Push the static response out as far as the socket takes it. Returns false while
+// bytes remain, true once everything is sent or the client went away.
+bool send_static(task_t &task) {
+    cached_file_t *file = task.file.get();
+    while (true) {
+        ssize_t retval;
+        bool body_left = file != NULL && task.file_offset < file->size;
+        if (task.res_sent < task.res->length) {
+            // Header, together with the body when it is in memory
+            struct iovec iov[2];
+            iov[0].iov_base = task.res->buffer + task.res_sent;
+            iov[0].iov_len = task.res->length - task.res_sent;
+            int iovcnt = 1;
+            if (body_left && file->content != NULL) {
+                iov[1].iov_base = file->content;
+                iov[1].iov_len = file->size;
+                iovcnt = 2;
+            }
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = iovcnt;
+            retval = sendmsg(task.frontend_conn, &msg, MSG_NOSIGNAL);
+            if (retval > 0) {
+                ssize_t header = min<ssize_t>(retval, iov[0].iov_len);
+                task.res_sent += header;
+                task.file_offset += retval - header;
+            }
+        }
+        else if (body_left && file->content != NULL) {
+            retval = send(task.frontend_conn, file->content + task.file_offset,
+                file->size - task.file_offset, MSG_NOSIGNAL);
+            if (retval > 0)
+                task.file_offset += retval;
+        }
+        else if (body_left) {
+            retval = sendfile(task.frontend_conn, file->fd, &task.file_offset, file->size - task.file_offset);
+        }
+        else {
+            return true;
+        }
+
+        if (retval < 0)
+            return errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR;
+        if (retval == 0)
+            return true;
+    }
+}
+
+class worker_pool_t {
+public:
+    const pool_config_t *config;
+    vector<backend_t*> workers;
+    int active;
+    int inflight;
+    int num_recycled;
+
+    worker_pool_t(const pool_config_t *config_): config(config_), active(0), inflight(0), num_recycled(0) {}
+
+    backend_t *active_worker() {
+        return workers[active];
+    }
+
+    // Another worker of the pool to hedge to, or NULL
+    backend_t *next_worker(backend_t *worker) {
+        for (size_t i = 0; i < workers.size() && workers.size() > 1; ++i)
+            if (workers[i] == worker)
+                return workers[(i + 1) % workers.size()];
+        return NULL;
+    }
+
+    // Take the active worker out of rotation as the restart policy says
+    void recycle() {
+        if (config->restart_policy == RESTART_NONE)
+            return;
+        backend_t *stalled = workers[active];
+        active = (active + 1) % workers.size();
+        if (config->restart_policy == RESTART_KILL)
+            stalled->restart();
+        else
+            cout << "Pretend to restart" << endl;
+        ++num_recycled;
+    }
+};
+
+int route_request(char *request) {
+    char method[16], path[1024], value[8];
+    bool has_path = http_get_request_line(request, method, sizeof(method), path, sizeof(path));
+    for (size_t i = 0; i < sizeof(ROUTES) / sizeof(ROUTES[0]); ++i) {
+        const route_rule_t &rule = ROUTES[i];
+        if (rule.prefix != NULL && (!has_path || strncmp(path, rule.prefix, strlen(rule.prefix)) != 0))
+            continue;
+        if (rule.header != NULL && http_get_header(request, rule.header, value, sizeof(value)) < 0)
+            continue;
+        return rule.pool;
+    }
+    return 0;
+}
+
+// Set by the load balancer on requests the detector flagged before dispatch
+bool is_flagged(char *request) {
+    char value[8];
+    return http_get_header(request, "X-RegexNet-Verdict", value, sizeof(value)) >= 0 && strcmp(value, "bad") == 0;
+}
+
+// Hedging of idempotent requests: a GET or HEAD still unanswered after the rolling
+// p99 latency of its route is duplicated to another worker, and whichever copy
+// answers first is forwarded. Hedges are paid from a token bucket that gains
+// HEDGE_BUDGET_PERCENT of a token per eligible request. Only requests queued behind
+// an older one on the same worker are hedged: the oldest one is what blocks the
+// single-threaded worker, and a copy of a ReDoS request would block a second worker.
+class hedge_policy_t {
+private:
+    map<string, rolling_quantile_t> routes;
+    rolling_quantile_t other_routes;
+    double tokens;
+
+public:
+    int num_hedged;
+    int num_won;
+
+    hedge_policy_t(): other_routes(HEDGE_WINDOW), tokens(HEDGE_BURST), num_hedged(0), num_won(0) {}
+
+    // Latency samples of the route (method and first path segment), or NULL if
+    // the request must not be hedged
+    rolling_quantile_t *classify(char *request) {
+        char method[16], path[1024];
+        if (!http_get_request_line(request, method, sizeof(method), path, sizeof(path)) || path[0] != '/')
+            return NULL;
+        if (strcmp(method, "GET") != 0 && strcmp(method, "HEAD") != 0)
+            return NULL;
+        tokens = min(tokens + HEDGE_BUDGET_PERCENT / 100.0, (double)HEDGE_BURST);
+
+        string route = string(method) + " " + string(path, strcspn(path + 1, "/") + 1);
+        map<string, rolling_quantile_t>::iterator itr = routes.find(route);
+        if (itr != routes.end())
+            return &itr->second;
+        if (routes.size() >= HEDGE_MAX_ROUTES)
+            return &other_routes;
+        return &routes.insert(make_pair(route, rolling_quantile_t(HEDGE_WINDOW))).first->second;
+    }
+
+    // The request waited long enough for a hedge and one can be paid for
+    bool due(rolling_quantile_t *route, int64_t waited) {
+        int64_t threshold = HEDGE_DEFAULT_DELAY_US;
+        if (route->size() >= HEDGE_MIN_SAMPLES)
+            threshold = max<int64_t>(route->quantile(HEDGE_QUANTILE), HEDGE_MIN_DELAY_US);
+        return waited >= threshold && tokens >= 1;
+    }
+
+    void spend() {
+        tokens -= 1;
+        ++num_hedged;
+    }
+} hedge_policy;
+
+// An older request forwarded to the same worker is still unanswered
+bool queued_behind(const task_t &task) {
+    for (deque<task_t>::const_iterator itr = task_q.begin(); itr != task_q.end(); ++itr) {
+        if (itr->stage == 2 && itr->backend == task.backend && itr->dispatch_time < task.dispatch_time)
+            return true;
+    }
+    return false;
+}
+
+// Sandbox processes shared by flagged requests. Flagged requests wait in a bounded
+// admission queue, one FIFO per source served round robin, so a single attacker can
+// only fill its own share. Each sandbox runs one request at a time, which lets the
+// CPU time of the process stand for the CPU time of the request; a sandbox that
+// exceeds the deadline is restarted, and the pending request then fails with a 503.
+class sandbox_pool_t {
+private:
+    struct slot_t {
+        backend_t *backend;
+        bool busy;
+        bool expired;
+        int64_t ready_time;
+        int64_t dispatch_time;
+        int64_t dispatch_cpu_time;
+    };
+
+    slot_t slots[NUM_SANDBOX];
+    map<int, deque<task_t> > waiting;
+    deque<int> source_rr;
+    int num_waiting;
+    int64_t last_sweep_time;
+
+public:
+    int num_rejected;
+    int num_expired;
+
+    sandbox_pool_t(backend_t **backends) {
+        for (int i = 0; i < NUM_SANDBOX; ++i) {
+            slots[i].backend = backends[i];
+            slots[i].busy = false;
+            slots[i].expired = false;
+            slots[i].ready_time = 0;
+        }
+        num_waiting = 0;
+        last_sweep_time = 0;
+        num_rejected = 0;
+        num_expired = 0;
+    }
+
+    bool owns(backend_t *backend) {
+        for (int i = 0; i < NUM_SANDBOX; ++i)
+            if (slots[i].backend == backend)
+                return true;
+        return false;
+    }
+
+    // Queue a flagged request; false means it must be shed
+    bool admit(const task_t &task) {
+        deque<task_t> &queue = waiting[task.source];
+        if (num_waiting >= SANDBOX_QUEUE_LIMIT || (int)queue.size() >= SANDBOX_SOURCE_LIMIT) {
+            if (queue.empty())
+                waiting.erase(task.source);
+            ++num_rejected;
+            return false;
+        }
+        if (queue.empty())
+            source_rr.push_back(task.source);
+        queue.push_back(task);
+        ++num_waiting;
+        return true;
+    }
+
+    // Hand waiting requests to idle sandboxes; the returned tasks hold a sandbox
+    // as their backend and still have to be forwarded.
+    void dispatch(vector<task_t> &ready, int64_t now) {
+        for (int i = 0; i < NUM_SANDBOX && num_waiting > 0; ++i) {
+            slot_t &slot = slots[i];
+            if (slot.busy || slot.ready_time > now)
+                continue;
+
+            int source = source_rr.front();
+            source_rr.pop_front();
+            deque<task_t> &queue = waiting[source];
+            task_t task = queue.front();
+            queue.pop_front();
+            --num_waiting;
+            if (queue.empty())
+                waiting.erase(source);
+            else
+                source_rr.push_back(source);
+
+            slot.busy = true;
+            slot.expired = false;
+            slot.dispatch_time = now;
+            int pid = slot.backend->get_pid();
+            slot.dispatch_cpu_time = pid > 0 ? process_cpu_time_us(pid) : -1;
+
+            task.backend = slot.backend;
+            task.backend_conn = -1;
+            ready.push_back(task);
+        }
+    }
+
+    void release(backend_t *backend) {
+        for (int i = 0; i < NUM_SANDBOX; ++i)
+            if (slots[i].backend == backend)
+                slots[i].busy = false;
+    }
+
+    // Restart every sandbox that overran its deadline
+    void sweep(int64_t now) {
+        if (now - last_sweep_time < SANDBOX_SWEEP_US)
+            return;
+        last_sweep_time = now;
+        reap_children();
+
+        for (int i = 0; i < NUM_SANDBOX; ++i) {
+            slot_t &slot = slots[i];
+            if (!slot.busy || slot.expired)
+                continue;
+
+            bool overrun = now - slot.dispatch_time > SANDBOX_WALL_DEADLINE_US;
+            int pid = slot.backend->get_pid();
+            if (!overrun && pid > 0 && slot.dispatch_cpu_time >= 0)
+                overrun = process_cpu_time_us(pid) - slot.dispatch_cpu_time > SANDBOX_CPU_DEADLINE_US;
+
+            if (overrun) {
+                fprintf(stderr, "Sandbox %d overran its deadline\n", i);
+                slot.expired = true;
+                slot.backend->restart();
+                slot.ready_time = now + SANDBOX_RESTART_US;
+                ++num_expired;
+            }
+        }
+    }
+};
+
 typedef struct {
     int id;
     int seqno;
@@ -231,15 +713,11 @@ void print_timestone(timestone ts, int64_t get_warning_time_us, int64_t complete
         << "Get warning sequence number: " << get_warning_seqno << endl;
 }
 
-int main() {
-    backend_t sandbox(ip_str_to_int(ADDR_SANDBOX), PORT_SANDBOX);
-    nodejs_t nodejs[4] = {
-        nodejs_t(INADDR_ANY, PORT_NODEJS_A),
-        nodejs_t(INADDR_ANY, PORT_NODEJS_B),
-        nodejs_t(INADDR_ANY, PORT_NODEJS_C),
-        nodejs_t(INADDR_ANY, PORT_NODEJS_D)
-        };
-    int active_server = 0;
+atomic_bool proxy_running(true);
+
+void run_proxy(worker_pool_t *pools, sandbox_pool_t &sandbox_pool) {
+    vector<task_t> sandbox_ready;
+    int64_t last_pool_sweep_time = 0;
     int cnt=0;
 
     map<int, timestone> connection_life;
@@ -247,8 +725,31 @@ int main() {
     map<int, int64_t> complete_warning_time;
     map<int, int> get_warning_seqno;
 
+    // Send the requests forwarded to a pool back to stage 1 and move the pool on
+    auto recycle_pool = [&](int p) {
+        if (pools[p].config->restart_policy == RESTART_NONE)
+            return;
+        for (deque<task_t>::iterator itr = task_q.begin(); itr != task_q.end(); ++itr) {
+            if (itr->stage == 2 && itr->pool == p && !sandbox_pool.owns(itr->backend)) {
+                itr->stage = 1;
+                --pools[p].inflight;
+                if (itr->backend_conn >= 0) {
+                    shutdown(itr->backend_conn, SHUT_WR);
+                    close(itr->backend_conn);
+                    itr->backend_conn = -1;
+                }
+                if (itr->hedge_conn >= 0) {
+                    close(itr->hedge_conn);
+                    itr->hedge_conn = -1;
+                    --pools[p].inflight;
+                }
+            }
+        }
+        pools[p].recycle();
+    };
+
     int queue_sequence_number = 0;
-    while (true) {
+    while (proxy_running) {
         ++queue_sequence_number;
         if (queue_sequence_number % 1000000 == 0)
             fprintf(stderr, "%d\n", queue_sequence_number);
@@ -262,28 +763,16 @@ int main() {
                     get_warning_time[malicious_id] = get_time_us();
                     get_warning_seqno[malicious_id] = queue_sequence_number;
                     malicious_set.insert(malicious_id);
-                    int flag = 0;
+                    int flag[NUM_POOLS] = {0};
                     for (deque<task_t>::iterator itr = task_q.begin(); itr != task_q.end(); ++itr) {
-                        if (malicious_set.find(itr->id) != malicious_set.end() && itr->stage == 2 && itr->backend != &sandbox)
-                            ++flag;
+                        if (malicious_set.find(itr->id) != malicious_set.end() && itr->stage == 2 && !sandbox_pool.owns(itr->backend))
+                            ++flag[itr->pool];
                     }
 
-                    if (flag > 0) {
-                        for (deque<task_t>::iterator itr = task_q.begin(); itr != task_q.end(); ++itr) {
-                            if (itr->stage == 2 && itr->backend != &sandbox) {
-                                itr->stage = 1;
-                                if (itr->backend_conn >= 0) {
-                                    shutdown(itr->backend_conn, SHUT_WR);
-                                    close(itr->backend_conn);
-                                    itr->backend_conn = -1;
-                                }
-                            }
-                        }
-
-                        int next_server = (active_server + 1) % NUM_NODEJS;
-                        // nodejs[active_server].restart();
-                        cout << "Pretend to restart" << endl;
-                        active_server = next_server;
+                    // Only the pools serving the malicious request are recycled
+                    for (int p = 0; p < NUM_POOLS; ++p) {
+                        if (flag[p] > 0)
+                            recycle_pool(p);
                     }
 
                     complete_warning_time[malicious_id] = get_time_us();
@@ -320,6 +809,38 @@ int main() {
             }
         }
 
+        // Recycle pools whose active worker sits on a request for too long
+        {
+            int64_t now = get_time_us();
+            if (now - last_pool_sweep_time >= POOL_SWEEP_US) {
+                last_pool_sweep_time = now;
+                for (int p = 0; p < NUM_POOLS; ++p) {
+                    if (pools[p].config->stall_us <= 0)
+                        continue;
+                    int stalled = 0;
+                    for (deque<task_t>::iterator itr = task_q.begin(); itr != task_q.end(); ++itr) {
+                        if (itr->stage == 2 && itr->pool == p && itr->backend == pools[p].active_worker() &&
+                            now - itr->dispatch_time > pools[p].config->stall_us) {
+                            itr->suspect = true;
+                            ++stalled;
+                        }
+                    }
+                    if (stalled > 0)
+                        recycle_pool(p);
+                }
+            }
+        }
+
+        // Move flagged requests from the admission queue to idle sandboxes
+        {
+            int64_t now = get_time_us();
+            sandbox_pool.sweep(now);
+            sandbox_pool.dispatch(sandbox_ready, now);
+            for (size_t i = 0; i < sandbox_ready.size(); ++i)
+                task_q.push_back(sandbox_ready[i]);
+            sandbox_ready.clear();
+        }
+
         // Receive request and forward to server / Receive response and forward to client
         if (! task_q.empty()) {
             int64_t start_time = get_time_us();
@@ -328,47 +849,162 @@ int main() {
             if (task.stage == 0) {
                 if (frontend.recv_request(task.frontend_conn, task.req) > 0) {
                     task.id = task.req->id;
-                    task.stage = 1;
+                    task.source = http_get_client(task.req->buffer);
+                    task.stage = serve_static(task, start_time) ? 4 : 1;
+                    task.backend = NULL;
                     task.backend_conn = -1;
+                    task.pool = route_request(task.req->buffer);
+                    task.suspect = is_flagged(task.req->buffer);
+                    task.route = task.stage == 1 ? hedge_policy.classify(task.req->buffer) : NULL;
+                    task.hedged = false;
+                    task.hedge_conn = -1;
 
                     connection_life[task.frontend_conn].id = task.id;
                     connection_life[task.frontend_conn].receive_cli_time = get_time_us();
                 }
                 task_q.push_back(task);
             }
+            else if (task.stage == 4) {
+                if (send_static(task)) {
+                    shutdown(task.frontend_conn, SHUT_WR);
+                    close(task.frontend_conn);
+                    delete task.req;
+                    delete task.res;
+                    malicious_set.erase(task.id);
+                    get_warning_time.erase(task.id);
+                    complete_warning_time.erase(task.id);
+                    get_warning_seqno.erase(task.id);
+                    connection_life.erase(task.frontend_conn);
+                }
+                else {
+                    task_q.push_back(task);
+                }
+            }
             else if (task.stage == 1) {
-                if (malicious_set.find(task.id) == malicious_set.end()) {
-                    task.backend = &nodejs[active_server];
+                worker_pool_t &pool = pools[task.pool];
+                if (sandbox_pool.owns(task.backend)) {
+                    // Already holds a sandbox handed out by the pool
+                }
+                else if (malicious_set.find(task.id) == malicious_set.end() && !task.suspect) {
+                    task.backend = pool.active_worker();
                 }
                 else {
-                    task.backend = &sandbox;
+                    // Wait in the sandbox admission queue, or fail fast when it is full
+                    if (task.backend_conn >= 0) {
+                        close(task.backend_conn);
+                        task.backend_conn = -1;
+                    }
+                    task.backend = NULL;
+                    if (!sandbox_pool.admit(task)) {
+                        task.res->length = http_make_status(task.res->buffer, "503 Service Unavailable");
+                        frontend.send_response(task.frontend_conn, task.res);
+                        shutdown(task.frontend_conn, SHUT_WR);
+                        close(task.frontend_conn);
+                        delete task.req;
+                        delete task.res;
+                        malicious_set.erase(task.id);
+                        get_warning_time.erase(task.id);
+                        complete_warning_time.erase(task.id);
+                        get_warning_seqno.erase(task.id);
+                        connection_life.erase(task.frontend_conn);
+                    }
+                    task.stage = 3;
                 }
 
-                if (task.backend_conn < 0)
-                    task.backend_conn = task.backend->request_connection();
-                if (task.backend_conn >= 0) {
-                    task.backend->send_request(task.backend_conn, task.req);
-                    task.req->timestamp = chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - program_start_time).count();
-                    task.stage = 2;
-
-                    connection_life[task.frontend_conn].request_ser_time = get_time_us();
+                // Stage 3: owned by the sandbox pool or already answered
+                bool sandboxed = sandbox_pool.owns(task.backend);
+                if (task.stage == 1 && !sandboxed && pool.inflight >= pool.config->concurrency_limit) {
+                    // Wait for the pool to drain below its concurrency limit
+                    task_q.push_back(task);
                 }
+                else if (task.stage == 1) {
+                    if (task.backend_conn < 0)
+                        task.backend_conn = task.backend->request_connection();
+                    if (task.backend_conn >= 0) {
+                        if (!sandboxed)
+                            ++pool.inflight;
+                        task.backend->send_request(task.backend_conn, task.req);
+                        task.req->timestamp = chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - program_start_time).count();
+                        task.dispatch_time = get_time_us();
+                        task.stage = 2;
+
+                        connection_life[task.frontend_conn].request_ser_time = get_time_us();
+                    }
 
-                task_q.push_back(task);
+                    task_q.push_back(task);
+                }
             }
             else if (task.stage == 2) {
-                if (task.backend->recv_response(task.backend_conn, task.res, task.id) > 0) {
+                int received = task.backend->recv_response(task.backend_conn, task.res, task.id);
+                bool sandboxed = sandbox_pool.owns(task.backend);
+
+                if (task.hedge_conn >= 0) {
+                    // Forward whichever copy answers first. The other copy only loses its
+                    // connection: a worker runs a request to its end, unless the stall
+                    // sweep or a warning recycles the worker.
+                    if (received > 0) {
+                        close(task.hedge_conn);
+                        task.hedge_conn = -1;
+                        --pools[task.pool].inflight;
+                    }
+                    else {
+                        int hedge_received = task.hedge_backend->recv_response(task.hedge_conn, task.res, task.id);
+                        if (hedge_received > 0) {
+                            close(task.backend_conn);
+                            task.backend = task.hedge_backend;
+                            task.backend_conn = task.hedge_conn;
+                            task.hedge_conn = -1;
+                            --pools[task.pool].inflight;
+                            received = hedge_received;
+                            ++hedge_policy.num_won;
+                        }
+                        else if (hedge_received < 0) {
+                            close(task.hedge_conn);
+                            task.hedge_conn = -1;
+                            --pools[task.pool].inflight;
+                        }
+                    }
+                }
+                else if (received == 0 && task.route != NULL && !task.hedged && !sandboxed &&
+                         malicious_set.find(task.id) == malicious_set.end() &&
+                         pools[task.pool].inflight < pools[task.pool].config->concurrency_limit &&
+                         hedge_policy.due(task.route, start_time - task.dispatch_time) &&
+                         queued_behind(task)) {
+                    // The copy takes a slot of the pool like any forwarded request
+                    task.hedged = true;
+                    task.hedge_backend = pools[task.pool].next_worker(task.backend);
+                    task.hedge_conn = -1;
+                    if (task.hedge_backend != NULL)
+                        task.hedge_conn = task.hedge_backend->request_connection();
+                    if (task.hedge_conn >= 0) {
+                        hedge_policy.spend();
+                        ++pools[task.pool].inflight;
+                        task.hedge_backend->send_request(task.hedge_conn, task.req);
+                    }
+                }
+
+                if (received > 0 && task.route != NULL)
+                    task.route->add(start_time - task.dispatch_time);
+
+                if (received < 0 && sandboxed) {
+                    // The sandbox was restarted for overrunning its deadline
+                    task.res->length = http_make_status(task.res->buffer, "503 Service Unavailable");
+                }
+                if (received > 0 || (received < 0 && sandboxed)) {
                     connection_life[task.frontend_conn].respond_ser_time = get_time_us();
                     int latency = connection_life[task.frontend_conn].respond_ser_time - connection_life[task.frontend_conn].request_ser_time;
                     // fprintf(stderr, "%d\n", latency);
 
-                    if (cnt<1000 || (task.backend != &sandbox && latency >= 500000)) {
+                    if (received < 0) {
+                        // Nothing worth reporting for a request cut short
+                    }
+                    else if (cnt<1000 || (!sandboxed && latency >= 500000)) {
                         cnt++;
                         // fprintf(stderr, "cnt:%d, latency:%d\n", cnt,latency);
                         reporter.send_report(task.req);
                         reporter.send_report(task.res);
                     }
-                    else if (task.backend == &sandbox && latency < 500000)
+                    else if (sandboxed && latency < 500000)
                     {
                         reporter.send_report(task.req);
                         reporter.send_report(task.res);
@@ -398,6 +1034,11 @@ int main() {
                     delete task.req;
                     delete task.res;
 
+                    if (sandboxed)
+                        sandbox_pool.release(task.backend);
+                    else
+                        --pools[task.pool].inflight;
+
                     malicious_set.erase(task.id);
                     get_warning_time.erase(task.id);
                     complete_warning_time.erase(task.id);
@@ -416,6 +1057,399 @@ int main() {
             int64_t latency_stage = end_time - start_time;
         }
     }
+}
+
+// Self-benchmark: stub backends, the proxy loop and a load generator in one process,
+// so the proxy can be measured without node.js, HAProxy or ab.
+//     ./http_proxy bench [--clients N] [--rate R] [--duration S]
+//                        [--service DIST] [--stall MS:PROB] [--flag RATIO] [--attack MS:RATIO]
+// DIST is const:US, exp:MEAN_US or uniform:MIN_US:MAX_US. --attack sends a share of the
+// requests with an If-None-Match header, so they reach the vulnerable pool, and makes
+// their worker stall for MS. A rate of 0 runs a closed
+// loop with N clients; otherwise requests arrive as a Poisson process at R req/s.
+
+#define BENCH_MAX_EVENTS    256
+#define BENCH_MAX_PENDING   16384
+
+struct service_time_t {
+    char kind; // 'c'onst, 'e'xponential or 'u'niform
+    double a, b;
+    double stall_ms;
+    double stall_prob;
+
+    service_time_t(): kind('c'), a(0), b(0), stall_ms(0), stall_prob(0) {}
+
+    bool parse(const char *spec) {
+        if (sscanf(spec, "const:%lf", &a) == 1)
+            kind = 'c';
+        else if (sscanf(spec, "exp:%lf", &a) == 1)
+            kind = 'e';
+        else if (sscanf(spec, "uniform:%lf:%lf", &a, &b) == 2)
+            kind = 'u';
+        else
+            return false;
+        return true;
+    }
+
+    bool parse_stall(const char *spec) {
+        return sscanf(spec, "%lf:%lf", &stall_ms, &stall_prob) == 2;
+    }
+};
+
+// Answers one request at a time, like the single-threaded node.js application
+class stub_backend_t: public backend_t {
+private:
+    tcp_server_t listener;
+    service_time_t service;
+    mt19937 rng;
+    atomic_bool abort_stall;
+
+    int64_t draw_service_time_us(char *request) {
+        // Requests sent with --attack carry their own stall
+        char value[16];
+        if (http_get_header(request, "X-Stall-Ms", value, sizeof(value)) > 0)
+            return atoll(value) * 1000;
+
+        double us = service.a;
+        if (service.kind == 'e')
+            us = exponential_distribution<double>(1.0 / max(service.a, 1.0))(rng);
+        else if (service.kind == 'u')
+            us = uniform_real_distribution<double>(service.a, service.b)(rng);
+        if (service.stall_prob > 0 && uniform_real_distribution<double>(0, 1)(rng) < service.stall_prob)
+            us += service.stall_ms * 1000;
+        return (int64_t)us;
+    }
+
+    void serve() {
+        static const char response[] = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: close\r\n\r\nok";
+        char *buffer = new char[MAX_LENGTH];
+        fcntl(listener.sockfd, F_SETFL, 0);
+
+        while (true) {
+            int conn = accept(listener.sockfd, NULL, NULL);
+            if (conn < 0)
+                continue;
+
+            int length = 0;
+            buffer[0] = '\0';
+            while (length < MAX_LENGTH - 1) {
+                int retval = read(conn, buffer + length, MAX_LENGTH - 1 - length);
+                if (retval < 1)
+                    break;
+                length += retval;
+                buffer[length] = '\0';
+                if (strstr(buffer, "\r\n\r\n") != NULL)
+                    break;
+            }
+
+            // Sleep in slices so that a restart can cut a stall short
+            abort_stall = false;
+            int64_t deadline = get_time_us() + draw_service_time_us(buffer);
+            for (int64_t now = get_time_us(); now < deadline && !abort_stall; now = get_time_us())
+                usleep(min<int64_t>(deadline - now, 1000));
+
+            if (!abort_stall)
+                tcp_send(conn, response, sizeof(response) - 1);
+            close(conn);
+        }
+    }
+
+public:
+    stub_backend_t(int port, const service_time_t &service_, int seed):
+        backend_t(ip_str_to_int("127.0.0.1"), port),
+        listener(ip_str_to_int("127.0.0.1"), port),
+        service(service_), rng(seed), abort_stall(false) {}
+
+    void start() {
+        thread(&stub_backend_t::serve, this).detach();
+    }
+
+    void restart() {
+        abort_stall = true;
+    }
+};
+
+class load_generator_t {
+private:
+    struct pending_t {
+        int64_t start_time;
+        bool sent;
+        bool attack;
+        int id;
+        char status[16];
+        int status_length;
+    };
+
+    int epfd;
+    int next_id;
+    mt19937 rng;
+    map<int, pending_t> pending;
+
+    void warn(int id) {
+        tcp_client_t client;
+        int conn = client.request_connection(ip_str_to_int("127.0.0.1"), PORT_WARNING);
+        if (conn < 0)
+            return;
+        char id_str[32];
+        int length = sprintf(id_str, "%d", id) + 1;
+        client.tcp_send(conn, id_str, length);
+        close(conn);
+    }
+
+    // Returns false if no connection could be opened
+    bool launch(int64_t now) {
+        if ((int)pending.size() >= BENCH_MAX_PENDING) {
+            ++num_overflow;
+            return false;
+        }
+
+        int id = next_id++;
+        if (flag_ratio > 0 && uniform_real_distribution<double>(0, 1)(rng) < flag_ratio)
+            warn(id);
+
+        int conn = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = ip_str_to_int("127.0.0.1");
+        addr.sin_port = htons(PORT_FRONTEND);
+        if (conn < 0 || (connect(conn, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS)) {
+            if (conn >= 0)
+                close(conn);
+            ++num_error;
+            return false;
+        }
+
+        struct epoll_event event;
+        event.events = EPOLLOUT;
+        event.data.fd = conn;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, conn, &event);
+
+        pending_t &p = pending[conn];
+        p.start_time = now;
+        p.sent = false;
+        p.attack = attack_ratio > 0 && uniform_real_distribution<double>(0, 1)(rng) < attack_ratio;
+        p.id = id;
+        p.status_length = 0;
+        return true;
+    }
+
+    void handle(int conn, int64_t now) {
+        pending_t &p = pending[conn];
+        if (!p.sent) {
+            char request[256];
+            int length;
+            if (p.attack)
+                length = sprintf(request, "GET / HTTP/1.1\r\nHost: localhost\r\nX-Unique-ID: %d\r\n"
+                    "If-None-Match: \"bench\"\r\nX-Stall-Ms: %d\r\n\r\n", p.id, attack_ms);
+            else
+                length = sprintf(request, "GET / HTTP/1.1\r\nHost: localhost\r\nX-Unique-ID: %d\r\n\r\n", p.id);
+            if (send(conn, request, length, MSG_NOSIGNAL) != length) {
+                finish(conn, false);
+                return;
+            }
+            p.sent = true;
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.fd = conn;
+            epoll_ctl(epfd, EPOLL_CTL_MOD, conn, &event);
+            return;
+        }
+
+        char buffer[4096];
+        while (true) {
+            int retval = read(conn, buffer, sizeof(buffer));
+            if (retval > 0) {
+                int n = min<int>(retval, sizeof(p.status) - 1 - p.status_length);
+                memcpy(p.status + p.status_length, buffer, n);
+                p.status_length += n;
+                continue;
+            }
+            if (retval < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return;
+            break;
+        }
+
+        p.status[p.status_length] = '\0';
+        if (strncmp(p.status, "HTTP/1.1 200", 12) == 0 && p.attack)
+            ++num_attack;
+        else if (strncmp(p.status, "HTTP/1.1 200", 12) == 0)
+            latencies.push_back(now - p.start_time);
+        else if (strncmp(p.status, "HTTP/1.1 503", 12) == 0)
+            ++num_shed;
+        else
+            ++num_error;
+        finish(conn, true);
+    }
+
+    void finish(int conn, bool answered) {
+        if (!answered)
+            ++num_error;
+        close(conn);
+        pending.erase(conn);
+    }
+
+public:
+    int clients;
+    double rate;
+    double duration;
+    double flag_ratio;
+    double attack_ratio;
+    int attack_ms;
+
+    vector<int64_t> latencies; // Of answered benign requests
+    int num_attack, num_shed, num_error, num_overflow, num_unfinished;
+
+    load_generator_t(): next_id(1), rng(1), clients(32), rate(0), duration(10), flag_ratio(0), attack_ratio(0),
+        attack_ms(0), num_attack(0), num_shed(0), num_error(0), num_overflow(0), num_unfinished(0) {}
+
+    void run() {
+        epfd = epoll_create1(0);
+        struct epoll_event events[BENCH_MAX_EVENTS];
+        exponential_distribution<double> interarrival(rate > 0 ? rate / 1e6 : 1);
+
+        int64_t now = get_time_us();
+        int64_t end_time = now + (int64_t)(duration * 1e6);
+        int64_t next_arrival = now;
+        while (now < end_time) {
+            int timeout_ms = 10;
+            if (rate > 0) {
+                for (; next_arrival <= now; next_arrival += (int64_t)interarrival(rng) + 1)
+                    launch(now);
+                timeout_ms = (int)min<int64_t>((next_arrival - now) / 1000, 10);
+            }
+            else {
+                // On failure (e.g. out of file descriptors), retry after the next wait
+                while ((int)pending.size() < clients && launch(now))
+                    ;
+            }
+
+            int n = epoll_wait(epfd, events, BENCH_MAX_EVENTS, timeout_ms);
+            now = get_time_us();
+            for (int i = 0; i < n; ++i)
+                handle(events[i].data.fd, now);
+        }
+
+        num_unfinished = pending.size();
+        for (map<int, pending_t>::iterator itr = pending.begin(); itr != pending.end(); ++itr)
+            close(itr->first);
+        pending.clear();
+        close(epfd);
+    }
+};
+
+int run_bench(int argc, char **argv) {
+    service_time_t service;
+    load_generator_t generator;
+    for (int i = 0; i + 1 < argc; i += 2) {
+        bool ok = true;
+        if (strcmp(argv[i], "--clients") == 0)
+            generator.clients = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--rate") == 0)
+            generator.rate = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "--duration") == 0)
+            generator.duration = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "--flag") == 0)
+            generator.flag_ratio = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "--service") == 0)
+            ok = service.parse(argv[i + 1]);
+        else if (strcmp(argv[i], "--stall") == 0)
+            ok = service.parse_stall(argv[i + 1]);
+        else if (strcmp(argv[i], "--attack") == 0)
+            ok = sscanf(argv[i + 1], "%d:%lf", &generator.attack_ms, &generator.attack_ratio) == 2;
+        else
+            ok = false;
+        if (!ok) {
+            fprintf(stderr, "Unrecognized option: %s %s\n", argv[i], argv[i + 1]);
+            return 1;
+        }
+    }
+    if (argc % 2 != 0) {
+        fprintf(stderr, "Missing value for option: %s\n", argv[argc - 1]);
+        return 1;
+    }
+    if (generator.clients < 1 || generator.clients > BENCH_MAX_PENDING) {
+        fprintf(stderr, "--clients must be between 1 and %d\n", BENCH_MAX_PENDING);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int seed = 0;
+    vector<worker_pool_t> pools;
+    for (int p = 0; p < NUM_POOLS; ++p) {
+        pools.push_back(worker_pool_t(&POOLS[p]));
+        for (int i = 0; i < POOLS[p].num_workers; ++i) {
+            stub_backend_t *stub = new stub_backend_t(POOLS[p].first_port + i, service, ++seed);
+            stub->start();
+            pools[p].workers.push_back(stub);
+        }
+    }
+    backend_t *sandbox[NUM_SANDBOX];
+    for (int i = 0; i < NUM_SANDBOX; ++i) {
+        stub_backend_t *stub = new stub_backend_t(PORT_SANDBOX + i, service, ++seed);
+        stub->start();
+        sandbox[i] = stub;
+    }
+    sandbox_pool_t sandbox_pool(sandbox);
+
+    thread load(
+        [&generator]() {
+            generator.run();
+            proxy_running = false;
+        });
+
+    syscall_counter_t syscalls;
+    syscalls.start();
+    int64_t start_time = get_time_us();
+    run_proxy(&pools[0], sandbox_pool);
+    double elapsed = (get_time_us() - start_time) / 1e6;
+    long long num_syscalls = syscalls.count();
+    load.join();
+
+    vector<int64_t> &latencies = generator.latencies;
+    sort(latencies.begin(), latencies.end());
+    size_t completed = latencies.size() + generator.num_attack;
+    size_t answered = completed + generator.num_shed;
+
+    printf("\nBenchmark ## ");
+    if (generator.rate > 0)
+        printf("Open loop, %.0f req/s offered, ", generator.rate);
+    else
+        printf("Closed loop, %d clients, ", generator.clients);
+    printf("%.1f s\n", elapsed);
+    printf("Completed: %zu (%d attacks), Shed (503): %d, Errors: %d, Unfinished: %d, Not sent: %d\n",
+        completed, generator.num_attack, generator.num_shed, generator.num_error, generator.num_unfinished, generator.num_overflow);
+    printf("Throughput: %.1f req/s\n", completed / elapsed);
+    printf("Hedged: %d, won by the hedge: %d\n", hedge_policy.num_hedged, hedge_policy.num_won);
+    size_t benign = latencies.size();
+    if (benign > 0)
+        printf("Latency of benign requests: p50 %lld us, p99 %lld us, max %lld us\n",
+            (long long)latencies[benign / 2],
+            (long long)latencies[min(benign - 1, benign * 99 / 100)],
+            (long long)latencies[benign - 1]);
+    if (answered > 0)
+        printf("Syscalls per request: %.1f%s\n", (double)num_syscalls / answered,
+            syscalls.exact ? "" : " (read/write only; raw_syscalls tracepoint unavailable)");
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+        return run_bench(argc - 2, argv + 2);
+
+    backend_t *sandbox[NUM_SANDBOX];
+    for (int i = 0; i < NUM_SANDBOX; ++i)
+        sandbox[i] = new nodejs_t(ip_str_to_int(ADDR_SANDBOX), PORT_SANDBOX + i);
+    sandbox_pool_t sandbox_pool(sandbox);
+
+    vector<worker_pool_t> pools;
+    for (int p = 0; p < NUM_POOLS; ++p) {
+        pools.push_back(worker_pool_t(&POOLS[p]));
+        for (int i = 0; i < POOLS[p].num_workers; ++i)
+            pools[p].workers.push_back(new nodejs_t(INADDR_ANY, POOLS[p].first_port + i));
+    }
 
+    run_proxy(&pools[0], sandbox_pool);
     return 0;
 }
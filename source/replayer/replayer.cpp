@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "util/tool.h"
+#include "util/sample_frame.h"
+#include "util/sample_log.h"
+
+// Replays recorded samples into the detector or the data manager at a
+// controlled rate, to benchmark them without the proxy and the attackers.
+//
+// Samples come from a collector sample log, or from a folder of train_data
+// files named <n>-<category>.txt. They are sent in bursts: to the detector
+// each sample is prefixed with its length like customize_send() does, to the
+// manager each burst is one uncompressed frame.
+
+#define ADDR_TARGET     "127.0.0.1"
+#define PORT_DETECTOR   9001
+#define PORT_MANAGER    9004
+
+#define MAX_LENGTH      100000  // Longer samples are cut, as the detector reads at most this much
+#define BURST_MAX_RATE  64      // Samples per burst when sending as fast as possible
+#define REPORT_US       1000000
+
+using namespace std;
+
+int64_t get_time_us() {
+    return chrono::duration_cast<chrono::microseconds>(
+        chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+struct replay_options_t {
+    const char *log_folder;
+    const char *train_folder;
+    bool to_manager;
+    const char *addr;
+    int port;
+    double rate;            // Samples per second, 0 for as fast as possible
+    int burst;              // Samples sent back to back, the average rate stays `rate`
+    long long count;        // Samples to send in total, looping over the input, 0 for one pass or until the duration
+    double duration;        // Seconds, 0 for no limit
+};
+
+// Holds the samples of either input; sample data points into the mapped log
+// or into `texts`
+class sample_source_t {
+private:
+    sample_log_reader_t *log;
+    vector<string> texts;
+
+public:
+    vector<sample_t> samples;
+
+    sample_source_t(): log(NULL) {}
+
+    ~sample_source_t() {
+        delete log;
+    }
+
+    void load_log(const char *folder) {
+        log = new sample_log_reader_t(folder);
+        samples.resize(log->size());
+        for (size_t i = 0; i < samples.size(); ++i)
+            log->get(i, samples[i]);
+    }
+
+    void load_train_data(const char *folder) {
+        DIR *dir = opendir(folder);
+        if (dir == NULL) {
+            perror("Open train data failed");
+            return;
+        }
+        vector<string> names;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            string name = entry->d_name;
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".txt") == 0)
+                names.push_back(name);
+        }
+        closedir(dir);
+        sort(names.begin(), names.end());
+
+        texts.resize(names.size());
+        vector<int> categories(names.size());
+        for (size_t i = 0; i < names.size(); ++i) {
+            ifstream file(string(folder) + "/" + names[i], ios::binary);
+            stringstream content;
+            content << file.rdbuf();
+            texts[i] = content.str();
+            size_t dash = names[i].find('-');
+            categories[i] = dash == string::npos ? 0 : atoi(names[i].c_str() + dash + 1);
+        }
+        // Filled in only now, as texts no longer moves
+        samples.resize(names.size());
+        for (size_t i = 0; i < names.size(); ++i) {
+            sample_t &sample = samples[i];
+            sample.id = i;
+            sample.label = categories[i] == 0 ? LABEL_BENIGN : LABEL_MALICIOUS;
+            sample.latency = 0;
+            sample.request_time = 0;
+            sample.response_time = 0;
+            sample.length = texts[i].size();
+            sample.data = texts[i].data();
+        }
+    }
+};
+
+class replayer_t {
+private:
+    replay_options_t opt;
+    const vector<sample_t> &samples;
+    int conn;
+    vector<char> out;
+
+    // Totals, and the same since the last report
+    long long num_samples, num_bytes;
+    int64_t blocked_us;
+    long long period_samples, period_bytes;
+    int64_t period_blocked_us, period_behind_us;
+
+    bool open_connection() {
+        if ((conn = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
+            perror("Socket creation failed");
+            return false;
+        }
+        int opt_on = 1;
+        setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &opt_on, sizeof(opt_on));
+
+        struct sockaddr_in serv_addr;
+        memset(&serv_addr, 0, sizeof(serv_addr));
+        serv_addr.sin_family = AF_INET;
+        serv_addr.sin_addr.s_addr = ip_str_to_int(opt.addr);
+        serv_addr.sin_port = htons(opt.port);
+        if (connect(conn, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0 && errno != EINPROGRESS) {
+            perror("Connection failed");
+            return false;
+        }
+        struct pollfd pfd;
+        pfd.fd = conn;
+        pfd.events = POLLOUT;
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (poll(&pfd, 1, -1) != 1 || getsockopt(conn, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+            printf ("Connection failed: %s\n", strerror(error));
+            return false;
+        }
+        return true;
+    }
+
+    void add_to_burst(const sample_t &sample, frame_writer_t &frame) {
+        if (opt.to_manager) {
+            frame.append(sample);
+            return;
+        }
+        uint32_t length_n = htonl(sample.length);
+        out.insert(out.end(), (const char*)&length_n, (const char*)&length_n + 4);
+        out.insert(out.end(), sample.data, sample.data + sample.length);
+    }
+
+    // Time spent waiting for the socket to drain is the receiver's backpressure
+    bool send_all() {
+        size_t offset = 0;
+        while (offset < out.size()) {
+            ssize_t sent = send(conn, out.data() + offset, out.size() - offset, MSG_NOSIGNAL);
+            if (sent > 0) {
+                offset += sent;
+                continue;
+            }
+            if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("Send failed");
+                return false;
+            }
+            struct pollfd pfd;
+            pfd.fd = conn;
+            pfd.events = POLLOUT;
+            int64_t start = get_time_us();
+            poll(&pfd, 1, -1);
+            int64_t waited = get_time_us() - start;
+            blocked_us += waited;
+            period_blocked_us += waited;
+        }
+        return true;
+    }
+
+    void report(int64_t now, int64_t period_start) {
+        double seconds = (now - period_start) / 1e6;
+        printf ("%.1f samples/s, %.2f MB/s, blocked %.1f%% of the time, %.1f ms behind schedule\n",
+                period_samples / seconds, period_bytes / seconds / 1e6, period_blocked_us / 1e4 / seconds,
+                period_behind_us / 1e3);
+        fflush(stdout);
+        period_samples = period_bytes = 0;
+        period_blocked_us = period_behind_us = 0;
+    }
+
+public:
+    replayer_t(const replay_options_t &opt_, const vector<sample_t> &samples_):
+        opt(opt_), samples(samples_), conn(-1), num_samples(0), num_bytes(0), blocked_us(0),
+        period_samples(0), period_bytes(0), period_blocked_us(0), period_behind_us(0) {}
+
+    ~replayer_t() {
+        if (conn >= 0)
+            close(conn);
+    }
+
+    bool run() {
+        if (!open_connection())
+            return false;
+        // With only a duration, loop over the input until it runs out
+        long long total = opt.count > 0 ? opt.count : opt.duration > 0 ? LLONG_MAX : (long long)samples.size();
+        printf ("Replaying %zu distinct samples to %s:%d\n", samples.size(), opt.addr, opt.port);
+
+        frame_writer_t frame;
+        int64_t start = get_time_us();
+        int64_t period_start = start;
+        int64_t deadline = opt.duration > 0 ? start + (int64_t)(opt.duration * 1e6) : 0;
+        size_t next = 0;
+        while (num_samples < total) {
+            // Bursts are due on the schedule of the average rate
+            int64_t now = get_time_us();
+            if (opt.rate > 0) {
+                int64_t due = start + (int64_t)(num_samples / opt.rate * 1e6);
+                if (due > now) {
+                    this_thread::sleep_for(chrono::microseconds(min<int64_t>(due - now, REPORT_US)));
+                    now = get_time_us();
+                    if (now < due)
+                        continue;
+                }
+                period_behind_us = max(period_behind_us, now - due);
+            }
+            if (deadline != 0 && now >= deadline)
+                break;
+            if (now - period_start >= REPORT_US) {
+                report(now, period_start);
+                period_start = now;
+            }
+
+            out.clear();
+            long long burst = min<long long>(opt.burst, total - num_samples);
+            long long bytes = 0;
+            for (long long i = 0; i < burst; ++i) {
+                const sample_t &sample = samples[next];
+                next = (next + 1) % samples.size();
+                sample_t copy = sample;
+                copy.length = min(copy.length, MAX_LENGTH);
+                add_to_burst(copy, frame);
+                bytes += copy.length;
+            }
+            if (opt.to_manager)
+                frame.finish(out);
+            if (!send_all())
+                return false;
+            num_samples += burst;
+            num_bytes += bytes;
+            period_samples += burst;
+            period_bytes += bytes;
+        }
+
+        int64_t now = get_time_us();
+        report(now, period_start);
+        double seconds = (now - start) / 1e6;
+        printf ("Sent %lld samples, %lld bytes in %.2f s: %.1f samples/s, %.2f MB/s, blocked %.1f%% of the time\n",
+                num_samples, num_bytes, seconds, num_samples / seconds, num_bytes / seconds / 1e6,
+                blocked_us / 1e4 / seconds);
+        return true;
+    }
+};
+
+void usage(const char *name) {
+    printf ("Usage: %s (--log DIR | --train DIR) [--manager] [--addr IP] [--port N]\n"
+            "       [--rate N] [--burst N] [--count N] [--duration SECONDS]\n"
+            "  --log DIR        a sample log written by data_collector\n"
+            "  --train DIR      a train_data folder of <n>-<category>.txt files\n"
+            "  --manager        send frames to the data_manager instead of the detector\n"
+            "  --rate N         samples per second, 0 for as fast as possible (default)\n"
+            "  --burst N        samples sent back to back, at the same average rate\n"
+            "  --count N        samples to send, looping over the input (default one pass)\n"
+            "  --duration S     stop after S seconds\n", name);
+}
+
+int main(int argc, char **argv) {
+    replay_options_t opt;
+    opt.log_folder = NULL;
+    opt.train_folder = NULL;
+    opt.to_manager = false;
+    opt.addr = ADDR_TARGET;
+    opt.port = 0;
+    opt.rate = 0;
+    opt.burst = 0;
+    opt.count = 0;
+    opt.duration = 0;
+    for (int i = 1; i < argc; ++i) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--log") == 0 && has_value)
+            opt.log_folder = argv[++i];
+        else if (strcmp(argv[i], "--train") == 0 && has_value)
+            opt.train_folder = argv[++i];
+        else if (strcmp(argv[i], "--manager") == 0)
+            opt.to_manager = true;
+        else if (strcmp(argv[i], "--addr") == 0 && has_value)
+            opt.addr = argv[++i];
+        else if (strcmp(argv[i], "--port") == 0 && has_value)
+            opt.port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--rate") == 0 && has_value)
+            opt.rate = atof(argv[++i]);
+        else if (strcmp(argv[i], "--burst") == 0 && has_value)
+            opt.burst = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--count") == 0 && has_value)
+            opt.count = atoll(argv[++i]);
+        else if (strcmp(argv[i], "--duration") == 0 && has_value)
+            opt.duration = atof(argv[++i]);
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if ((opt.log_folder == NULL) == (opt.train_folder == NULL)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (opt.port == 0)
+        opt.port = opt.to_manager ? PORT_MANAGER : PORT_DETECTOR;
+    if (opt.burst <= 0)
+        opt.burst = opt.rate > 0 ? 1 : BURST_MAX_RATE;
+
+    sample_source_t source;
+    if (opt.log_folder != NULL)
+        source.load_log(opt.log_folder);
+    else
+        source.load_train_data(opt.train_folder);
+    if (source.samples.empty()) {
+        printf ("No samples to replay\n");
+        return 1;
+    }
+
+    replayer_t replayer(opt, source.samples);
+    return replayer.run() ? 0 : 1;
+}
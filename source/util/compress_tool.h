@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include <zlib.h>
+
+// Raw deflate (no zlib header) everywhere; Python reads it with wbits=-15.
+
+// Preset dictionary for datagrams, which are compressed one by one and so have
+// no history of their own. Both ends of a datagram must use the same bytes.
+static const char DATAGRAM_DICTIONARY[] =
+    "Accept-Language: en-US,en;q=0.9\r\nAccept-Encoding: gzip, deflate\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: \r\nCookie: \r\n"
+    "If-None-Match: \r\nIf-Modified-Since: \r\nX-Forwarded-For: \r\nX-Unique-ID: \r\n"
+    "Connection: keep-alive\r\nConnection: close\r\nHost: \r\n"
+    "HTTP/1.1 200 OK\r\nHTTP/1.1\r\nPOST / GET /";
+
+// Compresses one datagram payload. Returns the compressed length, or -1 if
+// it does not fit in out_size and the payload should be sent as is.
+inline int deflate_datagram(const char *in, int length, char *out, int out_size) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_BEST_SPEED, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return -1;
+    deflateSetDictionary(&stream, (const Bytef*)DATAGRAM_DICTIONARY, sizeof(DATAGRAM_DICTIONARY) - 1);
+    stream.next_in = (Bytef*)in;
+    stream.avail_in = length;
+    stream.next_out = (Bytef*)out;
+    stream.avail_out = out_size;
+    int ret = deflate(&stream, Z_FINISH);
+    int compressed = out_size - stream.avail_out;
+    deflateEnd(&stream);
+    return ret == Z_STREAM_END ? compressed : -1;
+}
+
+// Returns the inflated length, or -1 if the payload is corrupt or too large
+inline int inflate_datagram(const char *in, int length, char *out, int out_size) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, -15) != Z_OK)
+        return -1;
+    inflateSetDictionary(&stream, (const Bytef*)DATAGRAM_DICTIONARY, sizeof(DATAGRAM_DICTIONARY) - 1);
+    stream.next_in = (Bytef*)in;
+    stream.avail_in = length;
+    stream.next_out = (Bytef*)out;
+    stream.avail_out = out_size;
+    int ret = inflate(&stream, Z_FINISH);
+    int inflated = out_size - stream.avail_out;
+    inflateEnd(&stream);
+    return ret == Z_STREAM_END ? inflated : -1;
+}
+
+// One deflate stream per connection. Each call emits a sync-flushed block,
+// so the receiver can decode every frame as soon as it arrives while later
+// frames still refer back to the earlier ones.
+class stream_deflater_t {
+private:
+    z_stream stream;
+    bool ready;
+
+public:
+    stream_deflater_t(): ready(false) {
+        reset();
+    }
+
+    ~stream_deflater_t() {
+        if (ready)
+            deflateEnd(&stream);
+    }
+
+    void reset() {
+        if (ready)
+            deflateEnd(&stream);
+        memset(&stream, 0, sizeof(stream));
+        ready = deflateInit2(&stream, Z_BEST_SPEED, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+
+    // Appends the compressed bytes to out
+    bool compress(const char *in, size_t length, std::vector<char> &out) {
+        if (!ready)
+            return false;
+        stream.next_in = (Bytef*)in;
+        stream.avail_in = length;
+        size_t chunk = deflateBound(&stream, length) + 16;
+        while (true) {
+            size_t start = out.size();
+            out.resize(start + chunk);
+            stream.next_out = (Bytef*)&out[start];
+            stream.avail_out = chunk;
+            int ret = deflate(&stream, Z_SYNC_FLUSH);
+            out.resize(out.size() - stream.avail_out);
+            if (ret != Z_OK && ret != Z_BUF_ERROR)
+                return false;
+            // Room left over means the flush is complete
+            if (stream.avail_out > 0)
+                return stream.avail_in == 0;
+        }
+    }
+};
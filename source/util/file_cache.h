@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <map>
+#include <memory>
+#include <string>
+
+// An open file with the validators and headers needed to answer for it.
+// Small files are also kept in memory; larger ones are sent from fd with sendfile.
+struct cached_file_t {
+    int fd;
+    off_t size;
+    time_t mtime;
+    const char *mime;
+    char etag[64];
+    char last_modified[64];
+    char *content;
+
+    cached_file_t(): fd(-1), size(0), mtime(0), mime(NULL), content(NULL) {
+        etag[0] = '\0';
+        last_modified[0] = '\0';
+    }
+
+    ~cached_file_t() {
+        if (fd >= 0)
+            close(fd);
+        delete[] content;
+    }
+};
+
+// Caches files from a list of document roots, looked up in order like
+// stacked express.static() middlewares. A cached file is stat()ed again at
+// most once per revalidate interval and reloaded if its size or mtime changed;
+// entries in use keep the old file open until their last reference goes away.
+class file_cache_t {
+private:
+    struct entry_t {
+        std::shared_ptr<cached_file_t> file; // NULL if no root has the file
+        int64_t checked_time;
+    };
+
+    const char **roots;
+    int num_roots;
+    size_t max_entries;
+    off_t inline_limit;
+    int64_t revalidate_us;
+    std::map<std::string, entry_t> entries;
+
+    static const char *mime_type(const std::string &path) {
+        static const char *types[][2] = {
+            {".css", "text/css; charset=UTF-8"},
+            {".js", "application/javascript; charset=UTF-8"},
+            {".html", "text/html; charset=UTF-8"},
+            {".txt", "text/plain; charset=UTF-8"},
+            {".svg", "image/svg+xml"},
+            {".png", "image/png"},
+            {".jpg", "image/jpeg"},
+            {".jpeg", "image/jpeg"},
+            {".gif", "image/gif"},
+            {".ico", "image/x-icon"},
+            {".woff", "font/woff"},
+            {".ttf", "font/ttf"},
+            {".eot", "application/vnd.ms-fontobject"}
+        };
+        size_t dot = path.rfind('.');
+        if (dot == std::string::npos || path.find('/', dot) != std::string::npos)
+            return NULL;
+        for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i)
+            if (strcasecmp(path.c_str() + dot, types[i][0]) == 0)
+                return types[i][1];
+        return NULL;
+    }
+
+    std::shared_ptr<cached_file_t> load(const std::string &path, const char *mime) {
+        for (int i = 0; i < num_roots; ++i) {
+            std::string full_path = std::string(roots[i]) + path;
+            int fd = open(full_path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                continue;
+
+            struct stat st;
+            if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+                close(fd);
+                continue;
+            }
+
+            std::shared_ptr<cached_file_t> file(new cached_file_t());
+            file->fd = fd;
+            file->size = st.st_size;
+            file->mtime = st.st_mtime;
+            file->mime = mime;
+            // Same weak validator as express.static: size and mtime in milliseconds
+            sprintf(file->etag, "W/\"%llx-%llx\"",
+                (unsigned long long)st.st_size, (unsigned long long)st.st_mtime * 1000);
+            struct tm tm;
+            gmtime_r(&st.st_mtime, &tm);
+            strftime(file->last_modified, sizeof(file->last_modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+            if (st.st_size <= inline_limit) {
+                file->content = new char[st.st_size > 0 ? st.st_size : 1];
+                if (pread(fd, file->content, st.st_size, 0) != st.st_size)
+                    return std::shared_ptr<cached_file_t>();
+            }
+            return file;
+        }
+        return std::shared_ptr<cached_file_t>();
+    }
+
+public:
+    file_cache_t(const char **roots_, int num_roots_, size_t max_entries_, off_t inline_limit_, int64_t revalidate_us_):
+        roots(roots_), num_roots(num_roots_), max_entries(max_entries_),
+        inline_limit(inline_limit_), revalidate_us(revalidate_us_) {}
+
+    // Path must start with '/' and carry no query string. Returns NULL for
+    // paths the cache refuses to serve and for files that do not exist.
+    std::shared_ptr<cached_file_t> lookup(const std::string &path, int64_t now) {
+        if (path.empty() || path[0] != '/' || path.find("..") != std::string::npos ||
+            path.find('%') != std::string::npos || path.find('\\') != std::string::npos)
+            return std::shared_ptr<cached_file_t>();
+        const char *mime = mime_type(path);
+        if (mime == NULL)
+            return std::shared_ptr<cached_file_t>();
+
+        std::map<std::string, entry_t>::iterator itr = entries.find(path);
+        if (itr != entries.end() && now - itr->second.checked_time < revalidate_us)
+            return itr->second.file;
+
+        if (itr != entries.end() && itr->second.file) {
+            // Keep the open file unless it changed on disk
+            std::shared_ptr<cached_file_t> &file = itr->second.file;
+            struct stat st;
+            for (int i = 0; i < num_roots; ++i) {
+                std::string full_path = std::string(roots[i]) + path;
+                if (stat(full_path.c_str(), &st) == 0) {
+                    if (S_ISREG(st.st_mode) && st.st_size == file->size && st.st_mtime == file->mtime) {
+                        itr->second.checked_time = now;
+                        return file;
+                    }
+                    break;
+                }
+            }
+        }
+
+        // Once full, new paths are served without being remembered
+        if (itr == entries.end() && entries.size() >= max_entries)
+            return load(path, mime);
+
+        entry_t &entry = entries[path];
+        entry.file = load(path, mime);
+        entry.checked_time = now;
+        return entry.file;
+    }
+};
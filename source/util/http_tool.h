@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <arpa/inet.h>
 
 int http_get_unique_id(char *buffer) {
@@ -23,4 +24,74 @@ int http_get_server(char *buffer) {
     int server;
 	inet_pton(AF_INET, server_str, &server);
     return server;
+}
+
+// Address of the original client, as appended by the load balancer ("option forwardfor").
+// The load balancer adds its header after any the client sent, so only the last one of
+// the header block is trusted. Returns -1 if the header is absent or malformed.
+int http_get_client(char *buffer) {
+    char *end = strstr(buffer, "\r\n\r\n");
+    char *ptr_client_str = NULL;
+    for (char *ptr = strstr(buffer, "\r\nX-Forwarded-For: "); ptr != NULL && (end == NULL || ptr < end);
+         ptr = strstr(ptr + 2, "\r\nX-Forwarded-For: "))
+        ptr_client_str = ptr;
+    if (ptr_client_str == NULL)
+        return -1;
+    ptr_client_str += strlen("\r\nX-Forwarded-For: ");
+
+    char client_str[64];
+    if (sscanf(ptr_client_str, "%63[^,\r\n ]", client_str) != 1)
+        return -1;
+
+    int client;
+    if (inet_pton(AF_INET, client_str, &client) != 1)
+        return -1;
+    return client;
+}
+
+// Write a body-less response with the given status line, e.g. "503 Service Unavailable".
+int http_make_status(char *buffer, const char *status) {
+    return sprintf(buffer, "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status);
+}
+
+
+// Method and path (query string removed) of the request line. Returns 0 if malformed.
+int http_get_request_line(char *buffer, char *method, int method_size, char *path, int path_size) {
+    char *ptr_end = strstr(buffer, "\r\n");
+    char *ptr_path = strchr(buffer, ' ');
+    if (ptr_end == NULL || ptr_path == NULL || ptr_path > ptr_end || ptr_path - buffer >= method_size)
+        return 0;
+    memcpy(method, buffer, ptr_path - buffer);
+    method[ptr_path - buffer] = '\0';
+
+    ++ptr_path;
+    int length = strcspn(ptr_path, " ?#\r");
+    if (length >= path_size)
+        return 0;
+    memcpy(path, ptr_path, length);
+    path[length] = '\0';
+    return 1;
+}
+
+// Value of a header, matched case-insensitively. Returns its length, or -1 if absent.
+int http_get_header(char *buffer, const char *name, char *value, int value_size) {
+    int name_length = strlen(name);
+    char *ptr_line = strstr(buffer, "\r\n");
+    while (ptr_line != NULL && ptr_line[2] != '\r' && ptr_line[2] != '\0') {
+        ptr_line += 2;
+        char *ptr_next = strstr(ptr_line, "\r\n");
+        if (strncasecmp(ptr_line, name, name_length) == 0 && ptr_line[name_length] == ':') {
+            char *ptr_value = ptr_line + name_length + 1;
+            while (*ptr_value == ' ' || *ptr_value == '\t')
+                ++ptr_value;
+            int length = ptr_next != NULL ? ptr_next - ptr_value : strlen(ptr_value);
+            if (length >= value_size)
+                length = value_size - 1;
+            memcpy(value, ptr_value, length);
+            value[length] = '\0';
+            return length;
+        }
+        ptr_line = ptr_next;
+    }
+    return -1;
 }
\ No newline at end of file
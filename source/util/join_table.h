@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <vector>
+
+// Power-of-two size classes for variable-size buffers. Released blocks are
+// kept for reuse; the total held from malloc never exceeds max_bytes, and
+// cached blocks of other classes are handed back first when it would.
+class block_pool_t {
+private:
+    static const int MIN_SHIFT = 8;
+    static const int NUM_CLASSES = 24;
+
+    std::vector<char*> free_blocks[NUM_CLASSES];
+    size_t max_bytes;
+
+    static int size_class(size_t length) {
+        int cls = 0;
+        while (((size_t)1 << (cls + MIN_SHIFT)) < length)
+            ++cls;
+        return cls;
+    }
+
+    static size_t class_size(int cls) {
+        return (size_t)1 << (cls + MIN_SHIFT);
+    }
+
+    void trim(size_t needed) {
+        for (int cls = NUM_CLASSES - 1; cls >= 0 && bytes_held + needed > max_bytes; --cls) {
+            while (!free_blocks[cls].empty() && bytes_held + needed > max_bytes) {
+                free(free_blocks[cls].back());
+                free_blocks[cls].pop_back();
+                bytes_held -= class_size(cls);
+            }
+        }
+    }
+
+public:
+    size_t bytes_held;  // In use or cached
+    size_t bytes_used;
+
+    block_pool_t(size_t max_bytes_): max_bytes(max_bytes_), bytes_held(0), bytes_used(0) {}
+
+    ~block_pool_t() {
+        for (int cls = 0; cls < NUM_CLASSES; ++cls)
+            for (size_t i = 0; i < free_blocks[cls].size(); ++i)
+                free(free_blocks[cls][i]);
+    }
+
+    // NULL if the block does not fit under the cap
+    char *alloc(size_t length) {
+        int cls = size_class(length);
+        if (cls >= NUM_CLASSES)
+            return NULL;
+        char *block;
+        if (!free_blocks[cls].empty()) {
+            block = free_blocks[cls].back();
+            free_blocks[cls].pop_back();
+        }
+        else {
+            trim(class_size(cls));
+            if (bytes_held + class_size(cls) > max_bytes)
+                return NULL;
+            block = (char*)malloc(class_size(cls));
+            if (block == NULL)
+                return NULL;
+            bytes_held += class_size(cls);
+        }
+        bytes_used += class_size(cls);
+        return block;
+    }
+
+    void release(char *block, size_t length) {
+        int cls = size_class(length);
+        free_blocks[cls].push_back(block);
+        bytes_used -= class_size(cls);
+    }
+};
+
+struct join_entry_t {
+    int id;
+    long long timestamp;
+    int length;
+    char *data;
+    int64_t expire_tick;
+    int prev, next;     // Timer wheel bucket list
+};
+
+// Holds requests until their response arrives, keyed by request ID.
+// Linear probing over entry indices with backward-shift deletion, so there
+// are no tombstones to clean up. Every entry sits in a timer wheel bucket and
+// is expired after ttl_us; when the entry count or the buffer pool reaches its
+// cap, the entries closest to expiry are evicted first. A request with an ID
+// already present replaces the older one.
+class join_table_t {
+private:
+    std::vector<join_entry_t> entries;
+    std::vector<int> free_entries;
+    std::vector<int> slots;     // Entry index or -1
+    size_t mask;
+    block_pool_t pool;
+
+    int64_t tick_us;
+    std::vector<int> wheel;
+    int64_t ttl_ticks;
+    int64_t current_tick;
+
+    size_t home(int id) {
+        return ((uint32_t)id * 2654435761u) & mask;
+    }
+
+    size_t find_slot(int id) {
+        size_t i = home(id);
+        while (slots[i] >= 0 && entries[slots[i]].id != id)
+            i = (i + 1) & mask;
+        return i;
+    }
+
+    void unlink_slot(size_t i) {
+        size_t j = i;
+        while (true) {
+            j = (j + 1) & mask;
+            if (slots[j] < 0)
+                break;
+            size_t k = home(entries[slots[j]].id);
+            // Move the entry back unless its home lies cyclically in (i, j]
+            bool stays = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+            if (!stays) {
+                slots[i] = slots[j];
+                i = j;
+            }
+        }
+        slots[i] = -1;
+    }
+
+    void wheel_insert(int index) {
+        join_entry_t &entry = entries[index];
+        int &head = wheel[entry.expire_tick % wheel.size()];
+        entry.prev = -1;
+        entry.next = head;
+        if (head >= 0)
+            entries[head].prev = index;
+        head = index;
+    }
+
+    void wheel_remove(int index) {
+        join_entry_t &entry = entries[index];
+        if (entry.prev >= 0)
+            entries[entry.prev].next = entry.next;
+        else
+            wheel[entry.expire_tick % wheel.size()] = entry.next;
+        if (entry.next >= 0)
+            entries[entry.next].prev = entry.prev;
+    }
+
+    // The entry that expires next
+    int oldest() {
+        for (size_t i = 1; i <= wheel.size(); ++i) {
+            int index = wheel[(current_tick + i) % wheel.size()];
+            if (index >= 0)
+                return index;
+        }
+        return -1;
+    }
+
+public:
+    long long num_inserted;
+    long long num_joined;
+    long long num_expired;
+    long long num_evicted;
+    long long num_replaced;
+    long long num_orphans;  // Responses with no request waiting
+    long long num_dropped;  // Requests too large for the pool
+
+    join_table_t(size_t max_entries, size_t max_bytes, int64_t ttl_us, int64_t tick_us_):
+        entries(max_entries), pool(max_bytes), tick_us(tick_us_), current_tick(0),
+        num_inserted(0), num_joined(0), num_expired(0), num_evicted(0), num_replaced(0),
+        num_orphans(0), num_dropped(0) {
+        for (int i = (int)max_entries - 1; i >= 0; --i)
+            free_entries.push_back(i);
+        size_t num_slots = 1;
+        while (num_slots < max_entries * 2)
+            num_slots <<= 1;
+        slots.assign(num_slots, -1);
+        mask = num_slots - 1;
+
+        ttl_ticks = (ttl_us + tick_us - 1) / tick_us;
+        wheel.assign(ttl_ticks + 2, -1);
+    }
+
+    size_t size() {
+        return entries.size() - free_entries.size();
+    }
+
+    size_t bytes_used() {
+        return pool.bytes_used;
+    }
+
+    size_t bytes_held() {
+        return pool.bytes_held;
+    }
+
+    join_entry_t *find(int id) {
+        int index = slots[find_slot(id)];
+        return index >= 0 ? &entries[index] : NULL;
+    }
+
+    void remove(join_entry_t *entry) {
+        int index = entry - &entries[0];
+        unlink_slot(find_slot(entry->id));
+        wheel_remove(index);
+        pool.release(entry->data, entry->length);
+        free_entries.push_back(index);
+    }
+
+    bool insert(int id, long long timestamp, const char *data, int length, int64_t now) {
+        advance(now);
+        join_entry_t *old = find(id);
+        if (old != NULL) {
+            remove(old);
+            ++num_replaced;
+        }
+
+        char *block;
+        while ((block = pool.alloc(length)) == NULL) {
+            int index = oldest();
+            if (index < 0) {
+                ++num_dropped;
+                return false;
+            }
+            remove(&entries[index]);
+            ++num_evicted;
+        }
+        if (free_entries.empty()) {
+            remove(&entries[oldest()]);
+            ++num_evicted;
+        }
+
+        int index = free_entries.back();
+        free_entries.pop_back();
+        join_entry_t &entry = entries[index];
+        entry.id = id;
+        entry.timestamp = timestamp;
+        entry.length = length;
+        entry.data = block;
+        memcpy(block, data, length);
+        entry.expire_tick = current_tick + ttl_ticks + 1;
+        slots[find_slot(id)] = index;
+        wheel_insert(index);
+        ++num_inserted;
+        return true;
+    }
+
+    // Drops every entry whose TTL has run out by now
+    void advance(int64_t now) {
+        int64_t now_tick = now / tick_us;
+        if (current_tick == 0)
+            current_tick = now_tick;
+        else if (now_tick - current_tick > (int64_t)wheel.size())
+            current_tick = now_tick - wheel.size();
+        while (current_tick < now_tick) {
+            ++current_tick;
+            int index = wheel[current_tick % wheel.size()];
+            while (index >= 0) {
+                int next = entries[index].next;
+                if (entries[index].expire_tick <= current_tick) {
+                    remove(&entries[index]);
+                    ++num_expired;
+                }
+                index = next;
+            }
+        }
+    }
+};
@@ -1,6 +1,14 @@
 #include <atomic>
 #include <chrono>
 #include <cstdio> 
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 class measure_t {
 private:
@@ -22,4 +30,135 @@ public:
             last_time = current_time;
         }
     }
+};
+
+// Counts the system calls entered by the calling thread. The raw_syscalls tracepoint
+// gives the exact number when perf may use it; otherwise the read and write counters
+// of /proc/thread-self/io are used, which miss accept, connect, close and the like.
+class syscall_counter_t {
+private:
+    int perf_fd;
+    long long base;
+
+    static long long read_tracepoint_id() {
+        const char *paths[] = {
+            "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+            "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id"
+        };
+        for (int i = 0; i < 2; ++i) {
+            FILE *fp = fopen(paths[i], "r");
+            if (fp == NULL)
+                continue;
+            long long id = -1;
+            if (fscanf(fp, "%lld", &id) != 1)
+                id = -1;
+            fclose(fp);
+            if (id >= 0)
+                return id;
+        }
+        return -1;
+    }
+
+    static long long read_io_syscalls() {
+        FILE *fp = fopen("/proc/thread-self/io", "r");
+        if (fp == NULL)
+            return 0;
+        char name[32];
+        long long value, total = 0;
+        while (fscanf(fp, "%31s %lld", name, &value) == 2) {
+            if (strcmp(name, "syscr:") == 0 || strcmp(name, "syscw:") == 0)
+                total += value;
+        }
+        fclose(fp);
+        return total;
+    }
+
+public:
+    bool exact;
+
+    syscall_counter_t() {
+        perf_fd = -1;
+        base = 0;
+        exact = false;
+    }
+
+    ~syscall_counter_t() {
+        if (perf_fd >= 0)
+            close(perf_fd);
+    }
+
+    void start() {
+        long long id = read_tracepoint_id();
+        if (id >= 0) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.type = PERF_TYPE_TRACEPOINT;
+            attr.size = sizeof(attr);
+            attr.config = id;
+            attr.disabled = 1;
+            perf_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+        exact = perf_fd >= 0;
+        if (exact) {
+            ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+        else {
+            base = read_io_syscalls();
+        }
+    }
+
+    long long count() {
+        if (!exact)
+            return read_io_syscalls() - base;
+        long long value = 0;
+        if (read(perf_fd, &value, sizeof(value)) != sizeof(value))
+            return -1;
+        return value;
+    }
+};
+
+// Quantile of the last `window` samples. The quantile is recomputed only after
+// window / 16 new samples, so reading it on every request stays cheap.
+class rolling_quantile_t {
+private:
+    std::vector<int64_t> samples;
+    std::vector<int64_t> scratch;
+    size_t window;
+    size_t next;
+    size_t fresh;
+    double cached_q;
+    int64_t cached_value;
+
+public:
+    rolling_quantile_t(size_t window_ = 256): window(window_), next(0), fresh(0), cached_q(-1), cached_value(0) {
+        samples.reserve(window);
+    }
+
+    void add(int64_t value) {
+        if (samples.size() < window)
+            samples.push_back(value);
+        else
+            samples[next] = value;
+        next = (next + 1) % window;
+        ++fresh;
+    }
+
+    size_t size() const {
+        return samples.size();
+    }
+
+    int64_t quantile(double q) {
+        if (samples.empty())
+            return 0;
+        if (q != cached_q || fresh * 16 >= window) {
+            scratch = samples;
+            size_t k = std::min(scratch.size() - 1, (size_t)(q * scratch.size()));
+            std::nth_element(scratch.begin(), scratch.begin() + k, scratch.end());
+            cached_q = q;
+            cached_value = scratch[k];
+            fresh = 0;
+        }
+        return cached_value;
+    }
 };
\ No newline at end of file
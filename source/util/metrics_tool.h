@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#include <string>
+
+// Helpers to render metrics in the Prometheus text exposition format
+
+// Cumulative histogram over fixed bucket bounds, in seconds
+class histogram_t {
+public:
+    static const int NUM_BOUNDS = 11;
+
+    long long buckets[NUM_BOUNDS + 1];  // The last one is +Inf
+    long long count;
+    double sum;
+
+    histogram_t(): count(0), sum(0) {
+        for (int i = 0; i <= NUM_BOUNDS; ++i)
+            buckets[i] = 0;
+    }
+
+    static double bound(int i) {
+        static const double BOUNDS[NUM_BOUNDS] = {
+            0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10
+        };
+        return BOUNDS[i];
+    }
+
+    void observe(double seconds) {
+        int i = 0;
+        while (i < NUM_BOUNDS && seconds > bound(i))
+            ++i;
+        ++buckets[i];
+        ++count;
+        sum += seconds;
+    }
+};
+
+inline void metric_family(std::string &out, const char *name, const char *type, const char *help) {
+    out += "# HELP ";
+    out += name;
+    out += " ";
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += " ";
+    out += type;
+    out += "\n";
+}
+
+// labels is a comma-separated list like `shard="0"`, or empty
+inline void metric_value(std::string &out, const char *name, const std::string &labels, double value) {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%.15g", value);
+    out += name;
+    if (!labels.empty())
+        out += "{" + labels + "}";
+    out += " ";
+    out += buffer;
+    out += "\n";
+}
+
+inline void metric_histogram(std::string &out, const char *name, const std::string &labels, const histogram_t &histogram) {
+    std::string prefix = labels.empty() ? "" : labels + ",";
+    std::string bucket = std::string(name) + "_bucket";
+    long long cumulative = 0;
+    char le[32];
+    for (int i = 0; i <= histogram_t::NUM_BOUNDS; ++i) {
+        cumulative += histogram.buckets[i];
+        if (i < histogram_t::NUM_BOUNDS)
+            snprintf(le, sizeof(le), "le=\"%g\"", histogram_t::bound(i));
+        else
+            snprintf(le, sizeof(le), "le=\"+Inf\"");
+        metric_value(out, bucket.c_str(), prefix + le, cumulative);
+    }
+    metric_value(out, (std::string(name) + "_sum").c_str(), labels, histogram.sum);
+    metric_value(out, (std::string(name) + "_count").c_str(), labels, histogram.count);
+}
@@ -0,0 +1,37 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+// CPU time (user + system) consumed so far by a process, in microseconds.
+// Returns -1 if the process does not exist.
+int64_t process_cpu_time_us(int pid) {
+    char path[64];
+    sprintf(path, "/proc/%d/stat", pid);
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+
+    char buffer[1024];
+    size_t length = fread(buffer, 1, sizeof(buffer) - 1, fp);
+    fclose(fp);
+    buffer[length] = '\0';
+
+    // The command name may contain spaces, so start after its closing parenthesis
+    char *ptr = strrchr(buffer, ')');
+    if (ptr == NULL)
+        return -1;
+
+    unsigned long long utime, stime;
+    if (sscanf(ptr + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2)
+        return -1;
+    return (int64_t)(utime + stime) * 1000000 / sysconf(_SC_CLK_TCK);
+}
+
+// Collect every child process that has exited, so restarted workers do not linger as zombies
+void reap_children() {
+    while (waitpid(-1, NULL, WNOHANG) > 0)
+        ;
+}
@@ -0,0 +1,135 @@
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+
+// Mean and variance of a stream. Exact (Welford) for the first `window`
+// values, then exponentially decayed with weight 1/window so the baseline
+// follows slow drifts of the traffic.
+class running_stats_t {
+private:
+    double window;
+
+public:
+    long long count;
+    double mean;
+    double m2;  // Sum of squared deviations while exact, variance once decayed
+
+    running_stats_t(double window_): window(window_), count(0), mean(0), m2(0) {}
+
+    double variance() {
+        if (count < 2)
+            return 0;
+        return count < window ? m2 / count : m2;
+    }
+
+    double stdev() {
+        return sqrt(variance());
+    }
+
+    void add(double value) {
+        ++count;
+        double delta = value - mean;
+        if (count <= window) {
+            mean += delta / count;
+            m2 += delta * (value - mean);
+            if (count == (long long)window)
+                m2 /= count;
+        }
+        else {
+            double alpha = 1.0 / window;
+            mean += alpha * delta;
+            m2 = (1 - alpha) * (m2 + alpha * delta * delta);
+        }
+    }
+
+    // Outside mean +- k stdev, with the stdev floored like data_manager.is_strange()
+    bool outlier(double value, double k, double min_stdev) {
+        double sd = stdev();
+        if (sd < min_stdev)
+            sd = min_stdev;
+        return value < mean - k * sd || value > mean + k * sd;
+    }
+
+    // Adds the value clamped to mean +- k stdev, so that single outliers
+    // only nudge the baseline
+    void add_clamped(double value, double k, double min_stdev) {
+        if (count >= 2) {
+            double sd = stdev();
+            if (sd < min_stdev)
+                sd = min_stdev;
+            if (value > mean + k * sd)
+                value = mean + k * sd;
+            else if (value < mean - k * sd)
+                value = mean - k * sd;
+        }
+        add(value);
+    }
+};
+
+// Latency and length baselines of one route, plus a token bucket that
+// limits how many benign samples of the route are forwarded
+struct route_stats_t {
+    running_stats_t latency;
+    running_stats_t length;
+    double tokens;
+    int64_t refill_time;
+
+    route_stats_t(double window, double burst):
+        latency(window), length(window), tokens(burst), refill_time(0) {}
+
+    bool take_token(int64_t now, double rate, double burst) {
+        if (refill_time != 0)
+            tokens = std::min(burst, tokens + (now - refill_time) * rate / 1e6);
+        refill_time = now;
+        if (tokens < 1)
+            return false;
+        tokens -= 1;
+        return true;
+    }
+};
+
+// Routes are keyed by method and the first path segment, e.g. "GET /search",
+// so IDs inside paths do not split a route. Once max_routes exist, new ones
+// share a catch-all entry.
+class route_table_t {
+private:
+    std::map<std::string, route_stats_t> routes;
+    size_t max_routes;
+    double window, burst;
+
+public:
+    route_table_t(size_t max_routes_, double window_, double burst_):
+        max_routes(max_routes_), window(window_), burst(burst_) {}
+
+    size_t size() {
+        return routes.size();
+    }
+
+    static std::string route_key(const char *data, int length) {
+        const char *end = data + length;
+        const char *space = (const char*)memchr(data, ' ', length);
+        if (space == NULL)
+            return "*";
+        const char *path = space + 1;
+        const char *p = path;
+        if (p < end && *p == '/')
+            ++p;
+        while (p < end && *p != '/' && *p != '?' && *p != ' ' && *p != '\r')
+            ++p;
+        return std::string(data, space - data) + " " + std::string(path, p - path);
+    }
+
+    route_stats_t &lookup(const char *data, int length) {
+        std::string key = route_key(data, length);
+        std::map<std::string, route_stats_t>::iterator itr = routes.find(key);
+        if (itr != routes.end())
+            return itr->second;
+        if (routes.size() >= max_routes)
+            key = "*";
+        return routes.insert(std::make_pair(key, route_stats_t(window, burst))).first->second;
+    }
+};
@@ -0,0 +1,132 @@
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#include <vector>
+
+#include <import/xxhash.h>
+
+// Header values that differ between otherwise identical requests
+static const char *DEDUP_MASKED_HEADERS[] = {
+    "X-Unique-ID",
+    "X-Forwarded-For"
+};
+
+// Remembers the content hashes of recently forwarded samples in a fixed-size,
+// 4-way set-associative table with round-robin replacement per set. A
+// duplicate is counted against the ID of the copy that was forwarded;
+// take_counts() hands the counts over, including those of evicted entries.
+class sample_dedup_t {
+private:
+    static const int WAYS = 4;
+
+    struct entry_t {
+        uint64_t hash;      // 0 if empty
+        int id;
+        unsigned count;     // Duplicates since the last take_counts()
+    };
+
+    std::vector<entry_t> entries;
+    std::vector<unsigned char> victim;
+    size_t mask;
+
+    struct count_t {
+        int id;
+        unsigned count;
+    };
+    std::vector<count_t> evicted;
+
+    static bool masked(const char *line, const char *end, const char **colon) {
+        for (size_t i = 0; i < sizeof(DEDUP_MASKED_HEADERS) / sizeof(DEDUP_MASKED_HEADERS[0]); ++i) {
+            size_t length = strlen(DEDUP_MASKED_HEADERS[i]);
+            if ((size_t)(end - line) > length && line[length] == ':'
+                    && strncasecmp(line, DEDUP_MASKED_HEADERS[i], length) == 0) {
+                *colon = line + length + 1;
+                return true;
+            }
+        }
+        return false;
+    }
+
+public:
+    long long num_unique;
+    long long num_duplicates;
+
+    sample_dedup_t(size_t capacity): num_unique(0), num_duplicates(0) {
+        size_t num_sets = 1;
+        while (num_sets * WAYS < capacity)
+            num_sets <<= 1;
+        entries.resize(num_sets * WAYS);
+        victim.resize(num_sets);
+        mask = num_sets - 1;
+        for (size_t i = 0; i < entries.size(); ++i)
+            entries[i].hash = 0;
+    }
+
+    // Hashes the request with the values of the masked headers left out.
+    // The seed separates copies whose latencies differ by orders of magnitude.
+    static uint64_t hash(const char *data, int length, uint64_t seed) {
+        XXH64_state_t state;
+        XXH64_reset(&state, seed);
+
+        const char *end = data + length;
+        const char *body = (const char*)memmem(data, length, "\r\n\r\n", 4);
+        const char *headers_end = body != NULL ? body : end;
+        const char *start = data;
+        const char *line = (const char*)memmem(data, headers_end - data, "\r\n", 2);
+        while (line != NULL) {
+            line += 2;
+            const char *line_end = (const char*)memmem(line, headers_end - line, "\r\n", 2);
+            if (line_end == NULL)
+                line_end = headers_end;
+            const char *colon;
+            if (masked(line, line_end, &colon)) {
+                XXH64_update(&state, start, colon - start);
+                start = line_end;
+            }
+            line = line_end < headers_end ? line_end : NULL;
+        }
+        XXH64_update(&state, start, end - start);
+        uint64_t value = XXH64_digest(&state);
+        return value != 0 ? value : 1;
+    }
+
+    // True if the sample has not been seen recently and should be forwarded
+    bool check(int id, uint64_t hash) {
+        size_t set = hash & mask;
+        entry_t *ways = &entries[set * WAYS];
+        for (int i = 0; i < WAYS; ++i) {
+            if (ways[i].hash == hash) {
+                ++ways[i].count;
+                ++num_duplicates;
+                return false;
+            }
+        }
+
+        entry_t &entry = ways[victim[set]];
+        victim[set] = (victim[set] + 1) % WAYS;
+        if (entry.hash != 0 && entry.count > 0) {
+            count_t count = {entry.id, entry.count};
+            evicted.push_back(count);
+        }
+        entry.hash = hash;
+        entry.id = id;
+        entry.count = 0;
+        ++num_unique;
+        return true;
+    }
+
+    // Calls handler(id, count) for every forwarded sample with duplicates since the last call
+    template <typename handler_t>
+    void take_counts(handler_t handler) {
+        for (size_t i = 0; i < evicted.size(); ++i)
+            handler(evicted[i].id, evicted[i].count);
+        evicted.clear();
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (entries[i].hash != 0 && entries[i].count > 0) {
+                handler(entries[i].id, entries[i].count);
+                entries[i].count = 0;
+            }
+        }
+    }
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+#include <arpa/inet.h>
+
+#include <vector>
+
+// Binary framing of samples from the collector to the manager. A frame
+// carries a batch of samples; all integers are big endian.
+//
+//  frame header (12 bytes):
+//      u16 magic, u8 version, u8 flags, u32 number of samples, u32 body length
+//  sample header (36 bytes), followed by the request bytes:
+//      i32 id, u32 length, u8 label hint, 3 reserved bytes,
+//      i64 latency, i64 request timestamp, i64 response timestamp
+//
+// Timestamps and latency are in microseconds, as reported by the proxy.
+//
+// A frame with FRAME_FLAG_COUNTS holds 8-byte records instead of samples:
+//      i32 id, u32 count
+// each counting copies of an earlier sample with that ID that were not sent.
+//
+// Compression is negotiated per connection. The collector opens with a
+// FRAME_FLAG_HELLO frame whose body is a u32 mask of the codecs it offers,
+// and the manager answers with a hello naming the one it picked. From then
+// on the collector may send FRAME_FLAG_DEFLATE frames: the body is a whole
+// inner frame, header included, compressed with the connection's single raw
+// deflate stream and sync-flushed at the end of the frame.
+#define FRAME_MAGIC         0x5258  // "RX"
+#define FRAME_VERSION       1
+#define FRAME_HEADER_SIZE   12
+#define SAMPLE_HEADER_SIZE  36
+#define COUNT_RECORD_SIZE   8
+
+#define FRAME_FLAG_COUNTS   0x01
+#define FRAME_FLAG_DEFLATE  0x02
+#define FRAME_FLAG_HELLO    0x04
+
+#define CODEC_DEFLATE       0x01
+
+#define LABEL_NONE          0   // Not labeled, the manager decides
+#define LABEL_BENIGN        1
+#define LABEL_OUTLIER       2   // Slow, but an ordinary length for its route
+#define LABEL_MALICIOUS     3   // Slow and of an unusual length: an attack candidate
+
+struct sample_t {
+    int id;
+    int label;
+    long long latency;
+    long long request_time;
+    long long response_time;
+    int length;
+    const char *data;
+};
+
+inline void put_frame_header(char *out, int flags, uint32_t num_samples, uint32_t body_length) {
+    uint16_t magic = htons(FRAME_MAGIC);
+    memcpy(out, &magic, 2);
+    out[2] = FRAME_VERSION;
+    out[3] = flags;
+    num_samples = htonl(num_samples);
+    body_length = htonl(body_length);
+    memcpy(out + 4, &num_samples, 4);
+    memcpy(out + 8, &body_length, 4);
+}
+
+inline void make_hello_frame(std::vector<char> &out, uint32_t codecs) {
+    out.resize(FRAME_HEADER_SIZE + 4);
+    put_frame_header(&out[0], FRAME_FLAG_HELLO, 0, 4);
+    codecs = htonl(codecs);
+    memcpy(&out[FRAME_HEADER_SIZE], &codecs, 4);
+}
+
+// Accumulates samples into one frame
+class frame_writer_t {
+private:
+    std::vector<char> frame;
+    uint32_t num_samples;
+
+    template <typename T>
+    void put(size_t offset, T value) {
+        memcpy(&frame[offset], &value, sizeof(value));
+    }
+
+public:
+    frame_writer_t(): num_samples(0) {
+        frame.resize(FRAME_HEADER_SIZE);
+    }
+
+    uint32_t size() {
+        return num_samples;
+    }
+
+    size_t bytes() {
+        return frame.size();
+    }
+
+    void append(const sample_t &sample) {
+        size_t offset = frame.size();
+        frame.resize(offset + SAMPLE_HEADER_SIZE + sample.length);
+        put(offset, htonl(sample.id));
+        put(offset + 4, htonl(sample.length));
+        frame[offset + 8] = sample.label;
+        memset(&frame[offset + 9], 0, 3);
+        put(offset + 12, htobe64(sample.latency));
+        put(offset + 20, htobe64(sample.request_time));
+        put(offset + 28, htobe64(sample.response_time));
+        memcpy(&frame[offset + SAMPLE_HEADER_SIZE], sample.data, sample.length);
+        ++num_samples;
+    }
+
+    // Only in frames finished with FRAME_FLAG_COUNTS
+    void append_count(int id, unsigned count) {
+        size_t offset = frame.size();
+        frame.resize(offset + COUNT_RECORD_SIZE);
+        put(offset, htonl(id));
+        put(offset + 4, htonl(count));
+        ++num_samples;
+    }
+
+    // Fills in the frame header and hands the frame over, leaving the writer empty
+    void finish(std::vector<char> &out, int flags = 0) {
+        put_frame_header(&frame[0], flags, num_samples, frame.size() - FRAME_HEADER_SIZE);
+        out.swap(frame);
+        frame.clear();
+        frame.resize(FRAME_HEADER_SIZE);
+        num_samples = 0;
+    }
+};
@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "util/sample_frame.h"
+
+// Append-only log of samples, split into segments. Segment <name> is a pair of
+// files: <name>.log holds the request bytes back to back, <name>.idx starts
+// with SAMPLE_LOG_MAGIC and then holds one fixed-size record per sample.
+// Records are little endian, as on the x86 hosts.
+//
+//  index record (40 bytes):
+//      u64 offset in .log, u32 length, i32 id, i64 latency, i64 request timestamp,
+//      u8 label, 7 reserved bytes
+//
+// A record is appended only after its bytes, so a reader sees a consistent
+// prefix of a segment that is still being written.
+#define SAMPLE_LOG_MAGIC        "RXIDX001"
+#define SAMPLE_LOG_MAGIC_SIZE   8
+#define SAMPLE_LOG_RECORD_SIZE  40
+
+struct sample_log_record_t {
+    uint64_t offset;
+    uint32_t length;
+    int32_t id;
+    int64_t latency;
+    int64_t timestamp;
+    uint8_t label;
+    uint8_t reserved[7];
+};
+
+static_assert(sizeof(sample_log_record_t) == SAMPLE_LOG_RECORD_SIZE, "index record layout");
+
+// Writes the segments <prefix>-<seq>, starting after the highest existing
+// sequence number so earlier segments are never touched. Samples are buffered
+// and written by flush().
+class sample_log_writer_t {
+private:
+    std::string folder, prefix;
+    size_t segment_size;
+    int seq;
+    int log_fd, idx_fd;
+    uint64_t log_size;
+    std::vector<char> log_buffer;
+    std::vector<sample_log_record_t> idx_buffer;
+
+    int last_seq() {
+        int last = -1;
+        DIR *dir = opendir(folder.c_str());
+        if (dir == NULL)
+            return last;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            std::string name = entry->d_name;
+            if (name.compare(0, prefix.size() + 1, prefix + "-") == 0)
+                last = std::max(last, atoi(name.c_str() + prefix.size() + 1));
+        }
+        closedir(dir);
+        return last;
+    }
+
+    void close_segment() {
+        if (log_fd >= 0)
+            close(log_fd);
+        if (idx_fd >= 0)
+            close(idx_fd);
+        log_fd = idx_fd = -1;
+    }
+
+    bool open_segment() {
+        char name[64];
+        snprintf(name, sizeof(name), "%s-%06d", prefix.c_str(), ++seq);
+        std::string path = folder + "/" + name;
+        log_fd = open((path + ".log").c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+        idx_fd = open((path + ".idx").c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+        if (log_fd < 0 || idx_fd < 0 || write(idx_fd, SAMPLE_LOG_MAGIC, SAMPLE_LOG_MAGIC_SIZE) != SAMPLE_LOG_MAGIC_SIZE) {
+            perror("Open sample log segment failed");
+            close_segment();
+            return false;
+        }
+        log_size = 0;
+        return true;
+    }
+
+    static bool write_all(int fd, const char *data, size_t length) {
+        while (length > 0) {
+            ssize_t written = write(fd, data, length);
+            if (written < 0)
+                return false;
+            data += written;
+            length -= written;
+        }
+        return true;
+    }
+
+public:
+    long long num_samples;
+    long long num_segments;
+    long long num_errors;
+
+    sample_log_writer_t(const char *folder_, const char *prefix_, size_t segment_size_):
+        folder(folder_), prefix(prefix_), segment_size(segment_size_), log_fd(-1), idx_fd(-1), log_size(0),
+        num_samples(0), num_segments(0), num_errors(0) {
+        mkdir(folder.c_str(), 0755);
+        seq = last_seq();
+    }
+
+    ~sample_log_writer_t() {
+        flush();
+        close_segment();
+    }
+
+    void append(const sample_t &sample) {
+        sample_log_record_t record;
+        memset(&record, 0, sizeof(record));
+        record.offset = log_size + log_buffer.size();
+        record.length = sample.length;
+        record.id = sample.id;
+        record.latency = sample.latency;
+        record.timestamp = sample.request_time;
+        record.label = sample.label;
+        log_buffer.insert(log_buffer.end(), sample.data, sample.data + sample.length);
+        idx_buffer.push_back(record);
+    }
+
+    void flush() {
+        if (idx_buffer.empty())
+            return;
+        if (log_fd < 0 || log_size + log_buffer.size() > segment_size) {
+            close_segment();
+            if (!open_segment()) {
+                num_errors += idx_buffer.size();
+                log_buffer.clear();
+                idx_buffer.clear();
+                return;
+            }
+            ++num_segments;
+            // Offsets were taken against the old segment
+            uint64_t base = idx_buffer[0].offset;
+            for (size_t i = 0; i < idx_buffer.size(); ++i)
+                idx_buffer[i].offset -= base;
+        }
+        if (!write_all(log_fd, log_buffer.data(), log_buffer.size())
+                || !write_all(idx_fd, (const char*)idx_buffer.data(), idx_buffer.size() * sizeof(sample_log_record_t))) {
+            perror("Write sample log failed");
+            num_errors += idx_buffer.size();
+            close_segment();
+        }
+        else {
+            log_size += log_buffer.size();
+            num_samples += idx_buffer.size();
+        }
+        log_buffer.clear();
+        idx_buffer.clear();
+    }
+};
+
+// Maps every segment of a folder for random access without copies. Segments
+// are ordered by name; the sample data points into the mapping and stays
+// valid as long as the reader.
+class sample_log_reader_t {
+private:
+    struct segment_t {
+        const char *log;
+        size_t log_size;
+        const sample_log_record_t *records;
+        size_t num_records;
+        size_t idx_size;
+    };
+
+    std::vector<segment_t> segments;
+    std::vector<size_t> starts;     // Index of the first sample of each segment
+    size_t total;
+
+    static const char *map_file(const std::string &path, size_t &size) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return NULL;
+        struct stat st;
+        const char *data = NULL;
+        size = 0;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (addr != MAP_FAILED) {
+                data = (const char*)addr;
+                size = st.st_size;
+            }
+        }
+        close(fd);
+        return data;
+    }
+
+public:
+    sample_log_reader_t(const char *folder): total(0) {
+        std::vector<std::string> names;
+        DIR *dir = opendir(folder);
+        if (dir == NULL) {
+            perror("Open sample log failed");
+            return;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            std::string name = entry->d_name;
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".idx") == 0)
+                names.push_back(name.substr(0, name.size() - 4));
+        }
+        closedir(dir);
+        std::sort(names.begin(), names.end());
+
+        for (size_t i = 0; i < names.size(); ++i) {
+            std::string path = std::string(folder) + "/" + names[i];
+            segment_t segment;
+            const char *idx = map_file(path + ".idx", segment.idx_size);
+            if (idx == NULL || segment.idx_size < SAMPLE_LOG_MAGIC_SIZE
+                    || memcmp(idx, SAMPLE_LOG_MAGIC, SAMPLE_LOG_MAGIC_SIZE) != 0) {
+                if (idx != NULL)
+                    munmap((void*)idx, segment.idx_size);
+                continue;
+            }
+            segment.records = (const sample_log_record_t*)(idx + SAMPLE_LOG_MAGIC_SIZE);
+            segment.num_records = (segment.idx_size - SAMPLE_LOG_MAGIC_SIZE) / SAMPLE_LOG_RECORD_SIZE;
+            segment.log = map_file(path + ".log", segment.log_size);
+            // Drop records whose bytes did not make it to the log
+            while (segment.num_records > 0) {
+                const sample_log_record_t &last = segment.records[segment.num_records - 1];
+                if (last.offset + last.length <= segment.log_size)
+                    break;
+                --segment.num_records;
+            }
+            segments.push_back(segment);
+            starts.push_back(total);
+            total += segment.num_records;
+        }
+    }
+
+    ~sample_log_reader_t() {
+        for (size_t i = 0; i < segments.size(); ++i) {
+            munmap((void*)((const char*)segments[i].records - SAMPLE_LOG_MAGIC_SIZE), segments[i].idx_size);
+            if (segments[i].log != NULL)
+                munmap((void*)segments[i].log, segments[i].log_size);
+        }
+    }
+
+    size_t size() {
+        return total;
+    }
+
+    void get(size_t index, sample_t &sample) {
+        size_t s = std::upper_bound(starts.begin(), starts.end(), index) - starts.begin() - 1;
+        const sample_log_record_t &record = segments[s].records[index - starts[s]];
+        sample.id = record.id;
+        sample.label = record.label;
+        sample.latency = record.latency;
+        sample.request_time = record.timestamp;
+        sample.response_time = record.timestamp + record.latency;
+        sample.length = record.length;
+        sample.data = segments[s].log + record.offset;
+    }
+};
@@ -42,7 +42,12 @@ public:
 
 class udp_server_t: public udp_t {
 public:
-	udp_server_t(int local_addr, int local_port): udp_t(local_addr, local_port) {
+	udp_server_t(int local_addr, int local_port, bool reuse_port = false): udp_t(local_addr, local_port) {
+		int enable = 1;
+		if (reuse_port && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0) {
+			perror("setsockopt(SO_REUSEPORT) failed");
+			exit(EXIT_FAILURE);
+		}
         if (bind(sockfd, (const struct sockaddr *)&servaddr, sizeof(servaddr)) < 0 ) { 
 			perror("bind failed");
 			exit(EXIT_FAILURE); 
@@ -51,7 +56,7 @@ public:
 
     int udp_recv(char *buffer, int MAX_LENGTH) {
 		struct sockaddr_in cliaddr;
-		unsigned int len_addr;
+		socklen_t len_addr = sizeof(cliaddr);
         int length;
 		length = recvfrom(sockfd, buffer, MAX_LENGTH, MSG_DONTWAIT, (struct sockaddr *)&cliaddr, &len_addr);
 		return length;